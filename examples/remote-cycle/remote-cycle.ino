@@ -11,10 +11,9 @@ Bonk::Pca9557 containmentPins(BONK_CONTAINMENT9557_ADDRESS);
 void setup() {
 	Wire.begin();
 	containmentPins.begin();
-	for (char i = 0; i < 8; i++) {
-		// will be low by default.
-		containmentPins.pinMode(i, OUTPUT);
-	}
+	// all eight pins become outputs in one transaction. They will be low by
+	// default.
+	containmentPins.configurePort(0xFF);
 }
 
 void loop() {
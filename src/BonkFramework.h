@@ -5,5 +5,9 @@
 #include "LogManager.h"
 #include "StateManager.h"
 #include "HardwareControl.h"
+#include "PowerMonitor.h"
+#include "Runtime.h"
+#include "EventCapture.h"
+#include "TelemetryLog.h"
 
 #endif
@@ -0,0 +1,186 @@
+#ifndef BONK_EVENT_CAPTURE_H
+#define BONK_EVENT_CAPTURE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <SdFat.h>
+
+#include "EventHandler.h"
+#include "Runtime.h"
+
+namespace Bonk {
+
+	// A channel to sample, eg the main INA226's current or the TMP411's remote
+	// temperature. Should be quick: it's called every sample period.
+	typedef int32_t (*CaptureChannel)();
+
+	// Samples a few channels into a RAM ring all the time, and when an armed
+	// flight event first shows up, keeps going for PostSamples more samples,
+	// freezes the ring and writes it to SD in the background. That gives
+	// full-rate data from just before to just after the event, without
+	// streaming everything to SD the whole flight.
+	//
+	// Add it to a Runtime with the sample period, and call trigger() from the
+	// event handlers (or with getLastReading().event after every tick; only the
+	// first reading of each event does anything). Sampling pauses while a
+	// window is being written, and events seen in the meantime are missed().
+	//
+	// Each capture is a header line, "capture <event> <millis>", then one line
+	// per sample: milliseconds relative to the trigger, then each channel.
+	template <uint8_t MaxChannels = 4, uint8_t Depth = 64, uint8_t PostSamples = Depth / 2>
+	class EventCapture: public Task {
+	public:
+		static_assert(PostSamples < Depth, "need room for samples before the event");
+
+		EventCapture():
+			_numChannels(0),
+			_armed(0),
+			_lastEvent(FlightEvent::NoneReached),
+			_state(State::SAMPLING),
+			_count(0),
+			_head(0),
+			_missed(0) { }
+
+		// Returns false if there's no room for it.
+		bool addChannel(CaptureChannel channel) {
+			if (_numChannels == MaxChannels) {
+				return false;
+			}
+			_channels[_numChannels++] = channel;
+			return true;
+		}
+
+		// capture around this event when it happens
+		void arm(FlightEvent event) {
+			_armed |= 1 << (uint8_t)event;
+		}
+
+		bool begin(const char *path) {
+			return _file.open(path, O_WRITE | O_APPEND | O_CREAT);
+		}
+
+		void trigger(FlightEvent event) {
+			if (event == _lastEvent) {
+				return;
+			}
+			_lastEvent = event;
+			if (!(_armed & (1 << (uint8_t)event))) {
+				return;
+			}
+			if (_state != State::SAMPLING) {
+				_missed++;
+				return;
+			}
+			_state = State::POST_TRIGGER;
+			_event = event;
+			_triggerMillis = millis();
+			_postLeft = PostSamples;
+		}
+
+		// take a sample, or write the next line of a frozen window.
+		bool runChunk() override {
+			switch (_state) {
+			case State::SAMPLING:
+				sample();
+				return false;
+			case State::POST_TRIGGER:
+				// with PostSamples 0, the window freezes at the trigger
+				if (_postLeft > 0) {
+					sample();
+					_postLeft--;
+				}
+				if (_postLeft == 0) {
+					writeHeader();
+					if (_count == 0) {
+						// triggered before the first sample: just the header
+						_file.sync();
+						_state = State::SAMPLING;
+						return false;
+					}
+					_state = State::WRITING;
+					_written = 0;
+					return true;
+				}
+				return false;
+			case State::WRITING:
+				if (_written < _count) {
+					writeLine();
+					_written++;
+				}
+				if (_written == _count) {
+					_file.sync();
+					_state = State::SAMPLING;
+					_count = 0;
+					return false;
+				}
+				return true;
+			}
+			return false;
+		}
+
+		// armed events that happened while a previous window was still being
+		// captured or written
+		uint8_t missed() const {
+			return _missed;
+		}
+	private:
+		enum class State : uint8_t {
+			SAMPLING,
+			POST_TRIGGER,
+			WRITING,
+		};
+
+		CaptureChannel _channels[MaxChannels];
+		int32_t _samples[Depth][MaxChannels];
+		uint16_t _sampleMillis[Depth]; // millis() % 65536, for each sample
+		FatFile _file;
+		unsigned long _triggerMillis;
+		uint8_t _numChannels;
+		uint16_t _armed; // bit per FlightEvent
+		FlightEvent _lastEvent;
+		FlightEvent _event; // the one being captured
+		State _state;
+		uint8_t _count; // samples in the ring
+		uint8_t _head; // where the next sample goes
+		uint8_t _postLeft;
+		uint8_t _written;
+		uint8_t _missed;
+
+		void sample() {
+			_sampleMillis[_head] = millis();
+			for (uint8_t i = 0; i < _numChannels; i++) {
+				_samples[_head][i] = _channels[i]();
+			}
+			_head = (_head + 1) % Depth;
+			if (_count < Depth) {
+				_count++;
+			}
+		}
+
+		void writeHeader() {
+			const char *name = "?";
+			switch (_event) {
+#define BONK_FLIGHT_EVENT(eventChar, flightEvent) case FlightEvent::flightEvent: name = #flightEvent; break;
+#include "FlightEvents.h"
+#undef BONK_FLIGHT_EVENT
+			}
+			char line[48];
+			snprintf(line, sizeof(line), "capture %s %lu\n", name, _triggerMillis);
+			_file.write(line);
+		}
+
+		// the _written-th oldest sample
+		void writeLine() {
+			uint8_t i = (_head + Depth - _count + _written) % Depth;
+			char line[16 + 12 * MaxChannels];
+			int n = snprintf(line, sizeof(line), "%d", (int16_t)(_sampleMillis[i] - (uint16_t)_triggerMillis));
+			for (uint8_t c = 0; c < _numChannels; c++) {
+				n += snprintf(line + n, sizeof(line) - n, ",%ld", (long)_samples[i][c]);
+			}
+			line[n++] = '\n';
+			_file.write((const uint8_t *)line, n);
+		}
+	};
+}
+
+#endif // BONK_EVENT_CAPTURE_H
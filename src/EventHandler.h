@@ -4,161 +4,274 @@
 #ifndef EVENT_MANAGER_H
 #define EVENT_MANAGER_H
 
+#include "Profiler.h"
+#include "ShipReading.h"
+#include "Triggers.h"
+
 #ifndef BONK_USB_SERIAL
 #define BONK_USB_SERIAL Serial
 #endif
 
-namespace Bonk {
+// Define BONK_RX_INTERRUPT to parse bytes in the serial receive interrupt
+// instead of in tick(); see EventHandler::receive().
 
-  enum class FlightEvent {
-#define BONK_FLIGHT_EVENT(blah, flightEvent) flightEvent,
-#include "FlightEvents.h"
-#undef BONK_FLIGHT_EVENT
-  };
-
-  const char NUM_FIELDS = 21;
-  const char NUM_LONG_FIELDS = 16;
-
-  // AVR, as an 8-bit architecture, aligns fields to 1 byte anyway. The
-  // attribute just makes absolutely sure.
-  typedef struct __attribute__((packed)) ShipReading {
-    long elapsed; // milliseconds, unsigned
-    long altitude; // micrometers, unsigned
-    long gpsAltitude; // micrometers, unsigned
-    long vx; // micrometers/second
-    long vy; // micrometers/second
-    long vz; // micrometers/second
-    long aTotal; // unsigned, micrometers/second^2
-    long ax; // micrometers/second^2
-    long ay; // micrometers/second^2
-    long az; // micrometers/second^2
-    long phi; // microradians
-    long theta; // microradians
-    long psi; // microradians
-    long angx; // microradians
-    long angy; // microradians
-    long angz; // microradians
-    bool launchImminent;
-    bool drogueChuteImminent;
-    bool landingImminent;
-    bool chuteFaultWarning;
-    FlightEvent event;
-  } ShipReading;
+namespace Bonk {
 
   // should be subclassed, adding event handlers.
   class EventHandler {
   public:
-    EventHandler() : _lastReading({ 0 }), // default flight event is NoneReached
+    EventHandler() :
+#ifdef BONK_RX_INTERRUPT
+		     _published{ { 0 }, { 0 } },
+		     _sequence(0),
+		     _dispatchedSequence(0),
+		     _supersededReadings(0),
+#else
+		     _lastReading({ 0 }), // default flight event is NoneReached
+#endif
 		     _curField(0),
-		     _buffer_n(0),
+		     _fieldChars(0),
+		     _value(0),
+		     _fracDigits(-1),
+		     _negative(false),
 		     // TODO: probably shouldn't be true? But on the other hand,
 		     // we should be able to detect if the packet is corrupted,
 		     // so it's probably fine.
-		     _readingNormally(true) { };
+		     _readingNormally(true),
+		     _triggers(nullptr) { };
 		     // other fields can be uninitialized
 
     void begin() {
       _lastDataMillis = millis() % 256;
+      _lastTickMillis = _lastDataMillis;
     }
 
     // call this every loop(). The more often you call it, the better! If you
-    // don't call it at least once 75ms or so, things will get nasty
+    // don't call it at least once 75ms or so, things will get nasty. Bonk::Runtime
+    // calls it for you, between every chunk of every other task. With
+    // BONK_RX_INTERRUPT, only the event handlers are kept waiting.
     void tick() {
+#ifdef BONK_RX_INTERRUPT
+      // a byte could come in halfway through finishing the reading. The
+      // line's quiet, so the interrupt handler won't be kept waiting long.
+      noInterrupts();
+      uint8_t curMillis = millis() % 256;
+      if ((uint8_t)(curMillis - _lastDataMillis) > 2 && _readingInProgress()) {
+        _finishReading();
+      }
+      interrupts();
+
+      uint8_t sequence = _sequence;
+      _barrier();
+      uint8_t latest = sequence & ~1;
+      if (latest != _dispatchedSequence) {
+        _supersededReadings += (uint8_t)(latest - _dispatchedSequence) / 2 - 1;
+        _dispatchedSequence = latest;
+        _runEvents();
+      }
+#else
       uint8_t curMillis = millis() % 256;
       uint8_t millisSinceLastData = curMillis - _lastDataMillis;
+      uint8_t millisSinceLastTick = curMillis - _lastTickMillis;
+      _lastTickMillis = curMillis;
       char incomingChar = BONK_USB_SERIAL.read();
 
       if (incomingChar > -1) {
-	if (millisSinceLastData > 75) {
+	BONK_PROFILE(Parse);
+	if (millisSinceLastData > 2 && _curField == NUM_FIELDS - 1) {
+	  // the last packet had got to its last field and then we didn't hear
+	  // from the ship for a while, so it most likely ended while we weren't
+	  // looking. Anything shorter is still arriving, just slower than we're
+	  // ticking.
+	  _finishReading();
+	}
+	if (millisSinceLastTick > 75) {
 	  // TODO: log that we're running behind
-	  // for now, the current reading is marked as invalid and discarded.
+	  // the serial buffer may well have overflowed since we last looked, so
+	  // whatever packet these bytes belong to is marked as invalid and
+	  // discarded once it ends.
           _failReading();
-	  _finishReading();
-	  return;
 	}
 
 	do {
 	  _processCharacter(incomingChar);
 	} while ((incomingChar = BONK_USB_SERIAL.read()) > -1);
+	_lastDataMillis = curMillis;
 
       } else { // incomingChar == -1, ie, no data available
-	if (millisSinceLastData > 2) {
+	if (millisSinceLastData > 2 && _readingInProgress()) {
 	  _finishReading();
 	}
       }
+#endif
     }
 
-    ShipReading getLastReading() const {
+#ifdef BONK_RX_INTERRUPT
+    // Call this from the ship's serial port's receive interrupt with each
+    // byte, eg, with the ship on Serial1 of a Mega:
+    //
+    //   ISR(USART1_RX_vect) {
+    //     events.receive(UDR1);
+    //   }
+    //
+    // The port can't also be used through HardwareSerial, which defines the
+    // same interrupt. Each byte is parsed as it arrives, so the receive buffer
+    // can't overflow however long loop() takes, and a finished reading is
+    // published to a double buffer. tick() still has to be called to run the
+    // event handlers, and to finish a reading once the line goes quiet.
+    void receive(char incoming) {
+      uint8_t curMillis = millis() % 256;
+      if ((uint8_t)(curMillis - _lastDataMillis) > 2 && _curField == NUM_FIELDS - 1) {
+        _finishReading();
+      }
+      _lastDataMillis = curMillis;
+      _processCharacter(incoming);
+    }
+
+    // false if getLastReading() might have been overwritten by the receive
+    // interrupt since tick() ran the event handlers for it, ie two more
+    // readings have come in. Check it after using getLastReading() if
+    // loop() could be that slow.
+    bool lastReadingIntact() const {
+      _barrier();
+      return (uint8_t)(_sequence - _dispatchedSequence) < 3;
+    }
+
+    // readings that came in, but were replaced by a newer one before tick()
+    // got to run the event handlers for them.
+    uint16_t supersededReadings() const {
+      return _supersededReadings;
+    }
+#endif
+
+    // The reading the event handlers last ran for. In BONK_RX_INTERRUPT mode
+    // it's in the double buffer, so see lastReadingIntact().
+    const ShipReading& getLastReading() const {
+#ifdef BONK_RX_INTERRUPT
+      return _published[(_dispatchedSequence >> 1) & 1];
+#else
       return _lastReading;
+#endif
     };
 
+    // evaluate these experiment-specific triggers on every accepted reading,
+    // right after its flight event handler, calling onTrigger for each one
+    // that fires.
+    void setTriggers(TriggerEngine& triggers) {
+      _triggers = &triggers;
+    }
+
   protected:
     // default event handlers -- all noop
 #define BONK_FLIGHT_EVENT(blah, flightEvent) virtual void on##flightEvent() const { };
 #include "FlightEvents.h"
 #undef BONK_FLIGHT_EVENT
+    // rule is the trigger's index in the table given to setTriggers.
+    virtual void onTrigger(uint8_t rule) const { };
 
   private:
-    static const uint8_t NUM_BUFFER_CHARS = 16;
+    static const uint8_t MAX_FIELD_CHARS = 16;
+#ifdef BONK_RX_INTERRUPT
+    // A seqlock over two buffers. The receive interrupt makes _sequence odd,
+    // writes the reading into the buffer that isn't the latest, and makes
+    // _sequence even again; the latest reading is always in
+    // _published[(_sequence >> 1) & 1], so readers never wait for a write.
+    ShipReading _published[2];
+    volatile uint8_t _sequence;
+    uint8_t _dispatchedSequence;      // _sequence, rounded down to even, when tick() last ran events
+    uint16_t _supersededReadings;
+#else
     ShipReading _lastReading;
+#endif
     ShipReading _partialReading;
     uint8_t _lastDataMillis;          // millis() % 256
+    uint8_t _lastTickMillis;          // millis() % 256
     uint8_t _curField;                // integer indicating which field we are currently reading
-    char _buffer[NUM_BUFFER_CHARS];   // the currently (partially) read field
-    uint8_t _buffer_n;                // index into _buffer, of the first empty spot
+    // the current field, parsed as it comes in
+    uint8_t _fieldChars;              // characters seen so far
+    char _firstChar;
+    uint32_t _value;                  // digits so far, without the sign or dot
+    int8_t _fracDigits;               // digits after the dot kept in _value, -1 before the dot
+    bool _negative;
     bool _readingNormally;            // false if any fatal errors been detected in the current reading
+    TriggerEngine *_triggers;
     // TODO: store the total number of packets that failed to read properly?
 
+    // true if we've seen any of the current reading
+    bool _readingInProgress() const {
+      return _curField > 0 || _fieldChars > 0 || !_readingNormally;
+    }
+
     // mark the reading as failed TODO: log an error
     void _failReading() {
       _readingNormally = false;
     }
 
-    // attempt to parse _buffer and insert it into partialReading
-    void _finishField() {
-      if (_buffer_n < NUM_BUFFER_CHARS) { // if this test fails, _readingNormally already set to
-                                          // false by _processCharacter
-        _buffer[_buffer_n] = '\0';
-
-        if (_curField == 0) { // special case for flight event
-          // should only be one character, and it should be one of the known
-          // flight event types.
-          if (_buffer_n == 1) {
-            switch (_buffer[0]) {
-#define BONK_FLIGHT_EVENT(eventChar, flightEvent) case eventChar: \
-		    _partialReading.event = FlightEvent::flightEvent;	\
-		    break;
-#include "FlightEvents.h"
-#undef BONK_FLIGHT_EVENT
-            default:
-              _failReading();
-            }
-          } else {
-            _failReading();
-          }
+    // fixed-point decimal places of the given field on the wire
+    static uint8_t _fieldDecimals(uint8_t field) {
+      switch (field) {
+#define BONK_READING_FIELD(member, Name, type, decimals) case (uint8_t)ReadingField::Name + 1: return decimals;
+#include "ShipReadingFields.h"
+#undef BONK_READING_FIELD
+      }
+      return 0;
+    }
 
-        } else if (_curField < 1 + NUM_LONG_FIELDS) { // one of the longs
-		// TODO: use strtol instead of atol to detect errors
-          ((long *)(&_partialReading))[_curField - 1] = atol(_buffer);
+    // the current field's value. The first argument just picks the type.
+    // Fails the reading if it doesn't fit in an int32_t.
+    int32_t _fieldValue(int32_t, uint8_t decimals) {
+      uint32_t value = _value;
+      for (int8_t i = _fracDigits < 0 ? 0 : _fracDigits; i < decimals; i++) {
+        if (value > 0xFFFFFFFFUL / 10) {
+          _failReading();
+          return 0;
+        }
+        value *= 10;
+      }
+      if (value > 0x7FFFFFFFUL + _negative) {
+        _failReading();
+        return 0;
+      }
+      return _negative ? (int32_t)(0 - value) : (int32_t)value;
+    }
 
-        } else if (_curField < NUM_FIELDS) { // one of the bools
-          bool val = false;
-          // enforce it being either 0 or 1
-          if (_buffer[0] == '1') {
-            val = true;
-          } else if (_buffer[0] != '0') {
-            _failReading();
-          }
-          // we could skip this if reading normally check above failed
-          ((bool *)(&_partialReading.launchImminent))[_curField - NUM_LONG_FIELDS - 1] = val;
+    bool _fieldValue(bool, uint8_t decimals) {
+      // enforce it being either 0 or 1
+      if (_fieldChars != 1 || (_firstChar != '0' && _firstChar != '1')) {
+        _failReading();
+      }
+      return _firstChar == '1';
+    }
 
-        } else { // too many fields
+    // put the field we just finished into partialReading
+    void _finishField() {
+      switch (_curField) {
+      case 0: {
+        // should only be one character, and it should be one of the known
+        // flight event types.
+        FlightEvent event;
+        if (_fieldChars == 1 && flightEventFromChar(_firstChar, event)) {
+          _partialReading.event = event;
+        } else {
           _failReading();
         }
+        break;
+      }
+#define BONK_READING_FIELD(member, Name, type, decimals) \
+      case (uint8_t)ReadingField::Name + 1:		     \
+        _partialReading.member = _fieldValue((type)0, decimals); \
+        break;
+#include "ShipReadingFields.h"
+#undef BONK_READING_FIELD
+      default: // too many fields
+        _failReading();
       }
 
       _curField++;
-      _buffer_n = 0;
+      _fieldChars = 0;
+      _value = 0;
+      _fracDigits = -1;
+      _negative = false;
     };
 
     // check if partialReading is legit, and if so move it into lastReading
@@ -168,34 +281,88 @@ namespace Bonk {
 	_readingNormally &&
 	_curField == NUM_FIELDS) {
 
+#ifdef BONK_RX_INTERRUPT
+	_publish();
+#else
 	_lastReading = _partialReading;
 	_runEvents();
+#endif
       }
       // unconditionally reset the state machine
       _curField = 0;
       _readingNormally = true;
-      // buffer_n already set by finishField
+      // the field state was already reset by finishField
     };
 
+#ifdef BONK_RX_INTERRUPT
+    // make partialReading the latest reading. Only in the receive interrupt,
+    // or with interrupts off.
+    void _publish() {
+      uint8_t sequence = _sequence;
+      _sequence = sequence + 1;
+      _barrier();
+      _published[((sequence >> 1) + 1) & 1] = _partialReading;
+      _barrier();
+      _sequence = sequence + 2;
+    }
+
+    // keeps the compiler from moving reads and writes of the double buffer
+    // across ones of _sequence
+    static void _barrier() {
+      __asm__ __volatile__("" ::: "memory");
+    }
+#endif
+
     // run the event corresponding to lastReading
     void _runEvents() {
-	    onCoastStart();
-      switch (_lastReading.event) {
+      BONK_PROFILE(EventDispatch);
+      switch (getLastReading().event) {
 #define BONK_FLIGHT_EVENT(eventChar, flightEvent) case FlightEvent::flightEvent: \
 	      on##flightEvent();					\
 	      break;
 #include "FlightEvents.h"
 #undef BONK_FLIGHT_EVENT
       }
+      if (_triggers != nullptr) {
+        uint32_t fired = _triggers->evaluate(getLastReading());
+        for (uint8_t i = 0; fired != 0; i++, fired >>= 1) {
+          if (fired & 1) {
+            onTrigger(i);
+          }
+        }
+      }
     }
 
     void _processCharacter(char incoming) {
-      if (_buffer_n == NUM_BUFFER_CHARS) {
+      if (incoming == ',') {
+        _finishField();
+        return;
+      }
+      if (_fieldChars == MAX_FIELD_CHARS) {
+        _failReading();
+        return;
+      }
+      if (_fieldChars++ == 0) {
+        _firstChar = incoming;
+      }
+      if (incoming >= '0' && incoming <= '9') {
+        if (_fracDigits < 0 || _fracDigits < _fieldDecimals(_curField)) {
+          if (_value > (0xFFFFFFFFUL - 9) / 10) {
+            // too big for any field, and would wrap
+            _failReading();
+            return;
+          }
+          _value = _value * 10 + (incoming - '0');
+          if (_fracDigits >= 0) {
+            _fracDigits++;
+          }
+        } // else more precision than we keep
+      } else if (incoming == '-' && _fieldChars == 1) {
+        _negative = true;
+      } else if (incoming == '.' && _fracDigits < 0) {
+        _fracDigits = 0;
+      } else if (_curField != 0) { // the flight event is a letter
         _failReading();
-      } else if (incoming == ',') {
-	      _finishField();
-      } else if (incoming != '.' || _curField == 1) { // don't store dots, unless part of elapsed time
-        _buffer[_buffer_n++] = incoming;
       }
     };
 
@@ -0,0 +1,85 @@
+// Copyright Eli Reed, 2020 released under GPLv3
+
+#ifndef FILE_STORAGE_H_
+#define FILE_STORAGE_H_
+
+#include <stdint.h>     // for uint32_t, uint16_t, uint8_t
+#include <string.h>     // for memcpy
+
+#include <fcntl.h>      // for open
+#include <sys/mman.h>   // for mmap
+#include <unistd.h>     // for ftruncate, close
+
+namespace Bonk {
+
+// StateManager storage in a memory-mapped file, for host tests and the
+// replay simulator. Writes land in the file as soon as they're made, so a
+// StateManager constructed over the same file later, even in another
+// process, sees what one that was "reset" left behind. Not for the Arduino.
+class FileStorage {
+  public:
+    // the file is created if it's not there, and made bytes long.
+    FileStorage(const char* path, uint32_t bytes) :
+        path_(path), bytes_(bytes), data_(nullptr) { }
+
+    // copies get their own mapping of the file at begin()
+    FileStorage(const FileStorage& other) :
+        path_(other.path_), bytes_(other.bytes_), data_(nullptr) { }
+    FileStorage& operator=(const FileStorage&) = delete;
+
+    ~FileStorage() {
+        if (data_ != nullptr) {
+            munmap(data_, bytes_);
+        }
+    }
+
+    bool begin() {
+        if (data_ != nullptr) {
+            return true;
+        }
+        int fd = open(path_, O_RDWR | O_CREAT, 0666);
+        if (fd < 0) {
+            return false;
+        }
+        if (ftruncate(fd, bytes_) != 0) {
+            close(fd);
+            return false;
+        }
+        void* mapped = mmap(nullptr, bytes_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mapped == MAP_FAILED) {
+            return false;
+        }
+        data_ = static_cast<uint8_t*>(mapped);
+        return true;
+    }
+
+    uint32_t size() const {
+        return bytes_;
+    }
+
+    bool read(uint32_t address, void* buf, uint16_t size) {
+        if (data_ == nullptr || address + size > bytes_) {
+            return false;
+        }
+        memcpy(buf, data_ + address, size);
+        return true;
+    }
+
+    bool write(uint32_t address, const void* buf, uint16_t size) {
+        if (data_ == nullptr || address + size > bytes_) {
+            return false;
+        }
+        memcpy(data_ + address, buf, size);
+        return true;
+    }
+
+  private:
+    const char* path_;
+    uint32_t bytes_;
+    uint8_t* data_;
+};  // FileStorage class
+
+}   // namespace BONK
+
+#endif  // FILE_STORAGE_H_
@@ -0,0 +1,125 @@
+// Copyright Eli Reed, 2020 released under GPLv3
+
+#ifndef FRAM_STORAGE_H_
+#define FRAM_STORAGE_H_
+
+#include <stdint.h>     // for uint32_t, uint16_t, uint8_t
+
+#include <SPI.h>        // for access to the FRAM chip
+
+namespace Bonk {
+
+// StateManager storage on an external SPI FRAM, like the MB85RS or FM25V
+// parts. Writes finish as fast as the bytes go over the bus and the chip
+// takes 10^14 of them, so records can be bigger and commits cheap. Chips up
+// to 64KB take 2 address bytes, bigger ones 3.
+//
+// Without a chip, MISO floats and reads come back all 1s or all 0s, which
+// would pass for data. So the write enable latch in the status register is
+// checked: begin() makes sure it follows WREN and WRDI, and every write that
+// it's set beforehand and cleared after.
+class FramStorage {
+  public:
+    // cs_pin: the chip's select line. bytes: its size.
+    FramStorage(uint8_t cs_pin, uint32_t bytes, uint32_t clock_hz = 8000000) :
+        cs_pin_(cs_pin), bytes_(bytes), settings_(clock_hz, MSBFIRST, SPI_MODE0) { }
+
+    bool begin() {
+        pinMode(cs_pin_, OUTPUT);
+        digitalWrite(cs_pin_, HIGH);
+        SPI.begin();
+        command(WREN);
+        bool enabled = status() & WEL;
+        command(WRDI);
+        return enabled && !(status() & WEL);
+    }
+
+    uint32_t size() const {
+        return bytes_;
+    }
+
+    bool read(uint32_t address, void* buf, uint16_t size) {
+        if (address + size > bytes_) {
+            return false;
+        }
+        // only write() sets WEL, and it's cleared again by the time it returns
+        if (status() & WEL) {
+            return false;
+        }
+        uint8_t* out = static_cast<uint8_t*>(buf);
+        select(READ, address);
+        for (uint16_t i = 0; i < size; i++) {
+            out[i] = SPI.transfer(0);
+        }
+        deselect();
+        return true;
+    }
+
+    bool write(uint32_t address, const void* buf, uint16_t size) {
+        if (address + size > bytes_) {
+            return false;
+        }
+        const uint8_t* in = static_cast<const uint8_t*>(buf);
+        // the chip forgets the write enable after every write
+        command(WREN);
+        if (!(status() & WEL)) {
+            return false;
+        }
+        select(WRITE, address);
+        for (uint16_t i = 0; i < size; i++) {
+            SPI.transfer(in[i]);
+        }
+        deselect();
+        return !(status() & WEL);
+    }
+
+  private:
+    static const uint8_t WREN = 0x06;
+    static const uint8_t WRDI = 0x04;
+    static const uint8_t RDSR = 0x05;
+    static const uint8_t WRITE = 0x02;
+    static const uint8_t READ = 0x03;
+    static const uint8_t WEL = 1 << 1;  // status register: writes enabled
+
+    // a command that's just the opcode
+    void command(uint8_t opcode) {
+        SPI.beginTransaction(settings_);
+        digitalWrite(cs_pin_, LOW);
+        SPI.transfer(opcode);
+        deselect();
+    }
+
+    uint8_t status() {
+        SPI.beginTransaction(settings_);
+        digitalWrite(cs_pin_, LOW);
+        SPI.transfer(RDSR);
+        uint8_t status = SPI.transfer(0);
+        deselect();
+        return status;
+    }
+
+    // starts a command that takes an address
+    void select(uint8_t opcode, uint32_t address) {
+        SPI.beginTransaction(settings_);
+        digitalWrite(cs_pin_, LOW);
+        SPI.transfer(opcode);
+        if (bytes_ > 0x10000) {
+            SPI.transfer(address >> 16);
+        }
+        SPI.transfer(address >> 8);
+        SPI.transfer(address);
+    }
+
+    void deselect() {
+        digitalWrite(cs_pin_, HIGH);
+        SPI.endTransaction();
+    }
+
+    uint8_t cs_pin_;
+    uint32_t bytes_;
+    SPISettings settings_;
+};  // FramStorage class
+
+}   // namespace BONK
+
+#endif  // FRAM_STORAGE_H_
@@ -4,6 +4,8 @@
 #include <Wire.h>
 #include <INA226.h>
 
+#include "Profiler.h"
+
 #define BONK_CONTAINMENT9557_ADDRESS 0b0011000
 #define BONK_MAIN226_ADDRESS 0b1000000
 #define BONK_BOOST226_ADDRESS 0b1000101
@@ -13,9 +15,33 @@
 
 namespace Bonk {
 
-	class Main226: public INA226 {
+	// The INA226 library's float readers, each under the Ina226 probe. They
+	// hide the library's own, so reads through Main226 and Boost226 are timed
+	// alongside PowerMonitor's.
+	class Profiled226: public INA226 {
+	public:
+		float readBusVoltage() {
+			BONK_PROFILE(Ina226);
+			return INA226::readBusVoltage();
+		}
+		float readShuntVoltage() {
+			BONK_PROFILE(Ina226);
+			return INA226::readShuntVoltage();
+		}
+		float readShuntCurrent() {
+			BONK_PROFILE(Ina226);
+			return INA226::readShuntCurrent();
+		}
+		float readBusPower() {
+			BONK_PROFILE(Ina226);
+			return INA226::readBusPower();
+		}
+	};
+
+	class Main226: public Profiled226 {
 	public:
 		void begin(float shuntResistor, float currentLimit) {
+			BONK_PROFILE(Ina226);
 			INA226::begin();
 			INA226::configure(
 				INA226_AVERAGES_4,
@@ -33,9 +59,10 @@ namespace Bonk {
 		}
 	};
 
-	class Boost226: public INA226 {
+	class Boost226: public Profiled226 {
 	public:
 		void begin(float shunt_resistor) {
+			BONK_PROFILE(Ina226);
 			INA226::begin(BONK_BOOST226_ADDRESS);
 			INA226::configure(
 				INA226_AVERAGES_4,
@@ -55,6 +82,35 @@ namespace Bonk {
 		pinMode(BONK_BOOST_ENABLE_PIN, OUTPUT);
 	}
 
+	// Where an I2C device lives, fixed at compile time: drivers instantiated
+	// with one of these store neither the address nor the bus, and every
+	// transaction compiles down to calls on Bus directly. Bus can be any
+	// object with the Wire API, so a second TwoWire or the USART in I2C mode
+	// works just as well, eg I2cDevice<0x4D, TwoWire, Wire1>.
+	template <uint8_t Addr, typename BusT = TwoWire, BusT& Bus = Wire>
+	struct I2cDevice {
+		static constexpr uint8_t address() {
+			return Addr;
+		}
+		static BusT& bus() {
+			return Bus;
+		}
+	};
+
+	// An I2C device on Wire whose address is only known at runtime.
+	class RuntimeI2cDevice {
+	public:
+		RuntimeI2cDevice(uint8_t addr): _addr(addr) { }
+		uint8_t address() const {
+			return _addr;
+		}
+		static TwoWire& bus() {
+			return Wire;
+		}
+	private:
+		uint8_t _addr;
+	};
+
 	enum class Pca9557Register {
 		REG_INPUT,
 		REG_OUTPUT,
@@ -62,14 +118,26 @@ namespace Bonk {
 		REG_CONFIG,
 	};
 
-	class Pca9557 {
+	// Device is an I2cDevice or RuntimeI2cDevice; see Pca9557 below for the
+	// usual one.
+	template <typename Device>
+	class BasicPca9557: private Device {
 	public:
-		Pca9557(uint8_t addr) {
+		BasicPca9557(const Device& device = Device()): Device(device) {
 			registerCache[0] = 0;
 			// this will be reset after begin(), though.
 			registerCache[1] = 0b11110000;
 			registerCache[2] = 0xFF;
-			_addr = addr;
+			_pointer = POINTER_UNKNOWN;
+			_staged = false;
+			_dirty = 0;
+			_polled = false;
+			_inputs = 0;
+			_raw = 0;
+			_rose = 0;
+			_fell = 0;
+			_debounceMillis = 0;
+			_changeLine = NO_CHANGE_LINE;
 		}
 
 		void begin() {
@@ -92,34 +160,189 @@ namespace Bonk {
 			writeRegister(Pca9557Register::REG_OUTPUT, newOut);
 		}
 
+		// every pin in outputMask becomes an output, every other pin becomes an
+		// input. One transaction, instead of one per pin.
+		void configurePort(const uint8_t outputMask) {
+			writeRegister(Pca9557Register::REG_CONFIG, ~outputMask);
+		}
+
+		// set the pins in mask to the corresponding bits of values, all at the
+		// same instant. Pins outside of mask keep their old value.
+		void writePort(const uint8_t mask, const uint8_t values) {
+			uint8_t oldOut = readRegister(Pca9557Register::REG_OUTPUT);
+			writeRegister(Pca9557Register::REG_OUTPUT, (oldOut & ~mask) | (values & mask));
+		}
+
+		// After stage(), pinMode, digitalWrite, configurePort and writePort only
+		// update the register cache. Nothing goes over the bus until commit(),
+		// which sends each changed register once, so any number of pin changes
+		// cost at most two transactions and all outputs switch together.
+		void stage() {
+			_staged = true;
+		}
+
+		void commit() {
+			_staged = false;
+			// outputs before config, so that a pin which is about to become an
+			// output never drives a stale value.
+			commitRegister(Pca9557Register::REG_OUTPUT);
+			commitRegister(Pca9557Register::REG_INVERT);
+			commitRegister(Pca9557Register::REG_CONFIG);
+		}
+
 		uint8_t digitalRead(const uint8_t pin) const {
 			return (readPins() >> pin) & 1;
 		}
+
+		// the whole input register, one bit per pin.
+		uint8_t readPort() const {
+			return readPins();
+		}
+
+		// The 9557 has no auto-increment: it keeps returning whichever register
+		// the last command byte selected, so input and output can't come back in
+		// a single burst. The output register is cached though, so this is still
+		// only the one input read.
+		void readPorts(uint8_t& input, uint8_t& output) const {
+			input = readPins();
+			output = readRegister(Pca9557Register::REG_OUTPUT);
+		}
+
+		// Input snapshots. Call pollInputs() once per loop (or from a Runtime
+		// task): it reads the input register in one transaction, debounces it,
+		// and works out which input pins changed. inputs(), rose() and fell()
+		// then answer from RAM, so checking all 8 pins costs nothing more.
+		//
+		// Returns true if the debounced inputs changed since the last poll.
+		bool pollInputs() {
+			_rose = 0;
+			_fell = 0;
+			bool settling = _raw != _inputs;
+			if (_polled && !settling && _changeLine != NO_CHANGE_LINE &&
+			    ::digitalRead(_changeLine) != _changeLineActive) {
+				// the chip says nothing's changed since it was last read
+				return false;
+			}
+			uint16_t now = millis();
+			uint8_t raw = readPins();
+			if (!_polled) {
+				_polled = true;
+				_inputs = _raw = raw;
+				_rawMillis = now;
+				return false;
+			}
+			if (raw != _raw) {
+				_raw = raw;
+				_rawMillis = now;
+			}
+			if (_raw == _inputs || (uint16_t)(now - _rawMillis) < _debounceMillis) {
+				return false;
+			}
+			// edges only for pins that are inputs
+			uint8_t changed = (_raw ^ _inputs) & readRegister(Pca9557Register::REG_CONFIG);
+			_rose = changed & _raw;
+			_fell = changed & ~_raw;
+			_inputs = _raw;
+			return changed != 0;
+		}
+
+		// the input register as of the last pollInputs(), debounced
+		uint8_t inputs() const {
+			return _inputs;
+		}
+		bool input(const uint8_t pin) const {
+			return (_inputs >> pin) & 1;
+		}
+		// input pins that went high or low at the last pollInputs()
+		uint8_t rose() const {
+			return _rose;
+		}
+		uint8_t fell() const {
+			return _fell;
+		}
+		bool rose(const uint8_t pin) const {
+			return (_rose >> pin) & 1;
+		}
+		bool fell(const uint8_t pin) const {
+			return (_fell >> pin) & 1;
+		}
+
+		// A change only shows up in inputs() once the port has read the same
+		// for debounceMillis; contacts on the containment unit bounce for a
+		// few ms. 0 (the default) takes every read as it is. It's per port,
+		// not per pin: a bouncing pin holds back a change on any other pin
+		// until it settles too.
+		void debounce(const uint8_t debounceMillis) {
+			_debounceMillis = debounceMillis;
+		}
+
+		// Only read the chip in pollInputs() when pin (an Arduino pin) is at
+		// activeLevel, or while a change is still being debounced, so a quiet
+		// containment unit costs no bus traffic at all. The 9557 itself has no
+		// interrupt output; this is for the PCA9554/TCA9554 in its place, which
+		// has the same registers and pulls INT low until the input register is
+		// read after a change.
+		void watchChangeLine(const uint8_t pin, const uint8_t activeLevel = LOW) {
+			::pinMode(pin, activeLevel == LOW ? INPUT_PULLUP : INPUT);
+			_changeLine = pin;
+			_changeLineActive = activeLevel;
+		}
 	private:
-		uint8_t _addr;
+		static const uint8_t POINTER_UNKNOWN = 0xFF;
+		static const uint8_t NO_CHANGE_LINE = 0xFF;
 		// we do not cache the input register, so the first element is the output register.
 		uint8_t registerCache[3];
+		// the register the chip's command byte currently points at. Reads keep
+		// returning that register, so we can skip rewriting it.
+		mutable uint8_t _pointer;
+		bool _staged;
+		uint8_t _dirty; // bit (reg - 1) set if the cached register hasn't been sent yet
+		bool _polled; // pollInputs() has read the chip at least once
+		uint8_t _inputs; // debounced
+		uint8_t _raw; // as of the last read
+		uint8_t _rose;
+		uint8_t _fell;
+		uint8_t _debounceMillis;
+		uint8_t _changeLine;
+		uint8_t _changeLineActive;
+		uint16_t _rawMillis; // when _raw last changed
 		void writeRegister(const Pca9557Register reg, const uint8_t data) {
-			// TODO: allow alternate wire, in case somebody insane wants to use the main i2c interface for
-			// something else (eg, a camera), though they should *really* be trying to use the extra USART as
-			// an I2C in that case.
-			if (reg > Pca9557Register::REG_INPUT && registerCache[(uint8_t)reg - 1] == data) {
+			uint8_t bit = 1 << ((uint8_t)reg - 1);
+			if (reg > Pca9557Register::REG_INPUT && registerCache[(uint8_t)reg - 1] == data && !(_dirty & bit)) {
 				// violating cse 143 guidelines: check!
 				return;
 			}
-			Wire.beginTransmission(_addr);
-			Wire.write((uint8_t)reg);
-			Wire.write(data);
-			// TODO: errors, here and on all other endTransmissions
-			Wire.endTransmission();
 			registerCache[(uint8_t)reg - 1] = data;
+			if (_staged) {
+				_dirty |= bit;
+				return;
+			}
+			sendRegister(reg);
+		}
+		void commitRegister(const Pca9557Register reg) {
+			if (_dirty & (1 << ((uint8_t)reg - 1))) {
+				sendRegister(reg);
+			}
+		}
+		void sendRegister(const Pca9557Register reg) {
+			BONK_PROFILE(Pca9557);
+			this->bus().beginTransmission(this->address());
+			this->bus().write((uint8_t)reg);
+			this->bus().write(registerCache[(uint8_t)reg - 1]);
+			// TODO: errors, here and on all other endTransmissions
+			_pointer = this->bus().endTransmission() == 0 ? (uint8_t)reg : POINTER_UNKNOWN;
+			_dirty &= ~(1 << ((uint8_t)reg - 1));
 		}
 		uint8_t readPins() const {
-			Wire.beginTransmission(_addr);
-			Wire.write((uint8_t)Pca9557Register::REG_INPUT);
-			Wire.endTransmission();
-			Wire.requestFrom(_addr, 1);
-			return Wire.read();
+			BONK_PROFILE(Pca9557);
+			if (_pointer != (uint8_t)Pca9557Register::REG_INPUT) {
+				this->bus().beginTransmission(this->address());
+				this->bus().write((uint8_t)Pca9557Register::REG_INPUT);
+				_pointer = this->bus().endTransmission() == 0 ?
+					(uint8_t)Pca9557Register::REG_INPUT : POINTER_UNKNOWN;
+			}
+			this->bus().requestFrom(this->address(), 1);
+			return this->bus().read();
 		}
 		// for reg > 0
 		uint8_t readRegister(const Pca9557Register reg) const {
@@ -127,6 +350,11 @@ namespace Bonk {
 		}
 	};
 
+	// address chosen at runtime, on Wire: Pca9557 pins(BONK_CONTAINMENT9557_ADDRESS);
+	typedef BasicPca9557<RuntimeI2cDevice> Pca9557;
+	// the containment unit's expander, with everything fixed at compile time.
+	typedef BasicPca9557<I2cDevice<BONK_CONTAINMENT9557_ADDRESS> > Containment9557;
+
 	enum class Tmp411Resolution {
 		RESOLUTION_9BIT,
 		RESOLUTION_10BIT,
@@ -156,52 +384,209 @@ namespace Bonk {
 		CONV_RATE_W   = 0x0A,
 		RESOLUTION_W  = 0x1A,
 	};
-  
-	class Tmp411 {
+
+	// Register values for a Tmp411 configuration known at compile time.
+	template <bool ExtendedRange = false,
+		  Tmp411Resolution Resolution = Tmp411Resolution::RESOLUTION_12BIT,
+		  Tmp411ConversionRate Rate = Tmp411ConversionRate::RATE_S125>
+	struct Tmp411Config {
+		static constexpr uint8_t configByte() {
+			return (1 << 7) | (ExtendedRange * (1 << 2));
+		}
+		static constexpr uint8_t conversionRateByte() {
+			return (uint8_t)Rate;
+		}
+		static constexpr uint8_t resolutionByte() {
+			return (uint8_t)Resolution;
+		}
+		// RATE_16S is 16000ms, and each step up halves it.
+		static constexpr uint16_t periodMs() {
+			return 16000 >> (uint8_t)Rate;
+		}
+	};
+
+	// The same, but settable at runtime through Tmp411::begin(...).
+	class RuntimeTmp411Config {
 	public:
-		Tmp411(uint8_t addr): _addr(addr) { }
+		RuntimeTmp411Config() {
+			set(false, Tmp411Resolution::RESOLUTION_12BIT, Tmp411ConversionRate::RATE_S125);
+		}
+		void set(bool extendedRange,
+			 Tmp411Resolution resolution,
+			 Tmp411ConversionRate conversionRate) {
+			_config = (1 << 7) | (extendedRange * (1 << 2));
+			_conversionRate = (uint8_t)conversionRate;
+			_resolution = (uint8_t)resolution;
+		}
+		uint8_t configByte() const {
+			return _config;
+		}
+		uint8_t conversionRateByte() const {
+			return _conversionRate;
+		}
+		uint8_t resolutionByte() const {
+			return _resolution;
+		}
+		uint16_t periodMs() const {
+			return 16000 >> _conversionRate;
+		}
+	private:
+		uint8_t _config;
+		uint8_t _conversionRate;
+		uint8_t _resolution;
+	};
+
+	// Device is an I2cDevice or RuntimeI2cDevice, Config a Tmp411Config or
+	// RuntimeTmp411Config. See Tmp411 below for the usual combination.
+	template <typename Device, typename Config = RuntimeTmp411Config>
+	class BasicTmp411: private Device, private Config {
+	public:
+		// a cached Tmp411 reads the temperatures once per conversion, just
+		// after the chip finishes it; the rest of the time, reads return the
+		// temperatures from the last conversion. See update().
+		BasicTmp411(const Device& device = Device(), bool cached = false):
+			Device(device),
+			_pointer(POINTER_UNKNOWN),
+			_cached(cached),
+			_haveReading(false),
+			_sawBusy(false),
+			_untilSync(0) { }
+		// only for a RuntimeTmp411Config
 		void begin(bool extendedRange,
 			   Tmp411Resolution resolution,
 			   Tmp411ConversionRate conversionRate) {
-			writeRegister(Tmp411Register::CONFIG_W, (1 << 7) | (extendedRange * (1 << 2)));
-			writeRegister(Tmp411Register::CONV_RATE_W, (uint8_t)conversionRate);
-			writeRegister(Tmp411Register::RESOLUTION_W, (uint8_t)resolution);
+			this->set(extendedRange, resolution, conversionRate);
+			begin();
 		}
 		void begin() {
-			Tmp411::begin(false,
-				      Tmp411Resolution::RESOLUTION_12BIT,
-				      Tmp411ConversionRate::RATE_S125);
+			writeRegister(Tmp411Register::CONFIG_W, this->configByte());
+			writeRegister(Tmp411Register::CONV_RATE_W, this->conversionRateByte());
+			writeRegister(Tmp411Register::RESOLUTION_W, this->resolutionByte());
+			_haveReading = false;
+			_sawBusy = false;
+			_untilSync = 0;
 		}
 		// shift right by 8 bits to get the temperature in celsius.
 		uint16_t readLocalTemperature() {
+			if (_cached) {
+				update();
+				return _localTemp;
+			}
 			return readRegister16(Tmp411Register::LOCAL_TEMP);
 		}
 		uint16_t readRemoteTemperature() {
+			if (_cached) {
+				update();
+				return _remoteTemp;
+			}
 			return readRegister16(Tmp411Register::REMOTE_TEMP);
 		}
+		// Refresh the cached temperatures if a new conversion has finished.
+		// Returns true if new values were read.
+		//
+		// To find out when conversions finish, it polls STATUS until BUSY
+		// goes from set to clear, which leaves the pointer on STATUS so each
+		// poll is a single read. From then on conversions finish a period
+		// apart, so it reads the temperatures a period after the last one
+		// without asking, three transactions where uncached reads of both take
+		// four, and finds the edge again every SYNC_REFRESHES conversions so
+		// the two clocks can't drift apart. While it's looking, the values
+		// are still refreshed at least once a period.
+		bool update() {
+			unsigned long now = millis();
+			uint16_t period = this->periodMs();
+			if (_haveReading && _untilSync > 0) {
+				if (now - _lastUpdateMillis < period) {
+					return false;
+				}
+				// skipping any conversions we weren't called for
+				_lastUpdateMillis += (now - _lastUpdateMillis) / period * period;
+				_untilSync--;
+				readTemperatures();
+				return true;
+			}
+			if (readRegister(Tmp411Register::STATUS) & STATUS_BUSY) {
+				_sawBusy = true;
+				return false;
+			}
+			if (_sawBusy) {
+				// a conversion just finished
+				_sawBusy = false;
+				_untilSync = SYNC_REFRESHES;
+				_lastUpdateMillis = now;
+				readTemperatures();
+				return true;
+			}
+			if (!_haveReading || now - _lastUpdateMillis >= period) {
+				_lastUpdateMillis = now;
+				_haveReading = true;
+				readTemperatures();
+				return true;
+			}
+			return false;
+		}
+		// status register: limit and open-circuit flags. Always read from the
+		// chip, cached or not.
+		uint8_t readStatus() {
+			return readRegister(Tmp411Register::STATUS);
+		}
 	private:
-		uint8_t _addr;
+		static const uint8_t POINTER_UNKNOWN = 0xFF;
+		static const uint8_t STATUS_BUSY = 1 << 7;
+		static const uint8_t SYNC_REFRESHES = 16;
+		unsigned long _lastUpdateMillis; // when the cached conversion finished, once synced
+		uint16_t _localTemp;
+		uint16_t _remoteTemp;
+		// the register the pointer currently selects. Reading the same register
+		// again doesn't need a pointer write first.
+		uint8_t _pointer;
+		bool _cached;
+		bool _haveReading;
+		bool _sawBusy; // STATUS read busy since the last conversion we saw end
+		uint8_t _untilSync; // refreshes left before finding the edge again
+		// whichever one the pointer was left on first, saving a pointer write
+		void readTemperatures() {
+			if (_pointer == (uint8_t)Tmp411Register::REMOTE_TEMP) {
+				_remoteTemp = readRegister16(Tmp411Register::REMOTE_TEMP);
+				_localTemp = readRegister16(Tmp411Register::LOCAL_TEMP);
+			} else {
+				_localTemp = readRegister16(Tmp411Register::LOCAL_TEMP);
+				_remoteTemp = readRegister16(Tmp411Register::REMOTE_TEMP);
+			}
+		}
 		void writeRegister(Tmp411Register reg, uint8_t val) {
-			Wire.beginTransmission(_addr);
-			Wire.write((uint8_t)reg);
-			Wire.write(val);
-			Wire.endTransmission();
+			BONK_PROFILE(Tmp411);
+			this->bus().beginTransmission(this->address());
+			this->bus().write((uint8_t)reg);
+			this->bus().write(val);
+			_pointer = this->bus().endTransmission() == 0 ? (uint8_t)reg : POINTER_UNKNOWN;
+		}
+		void setPointer(Tmp411Register reg) {
+			if (_pointer == (uint8_t)reg) {
+				return;
+			}
+			this->bus().beginTransmission(this->address());
+			this->bus().write((uint8_t)reg);
+			_pointer = this->bus().endTransmission() == 0 ? (uint8_t)reg : POINTER_UNKNOWN;
 		}
 		uint8_t readRegister(Tmp411Register reg) {
-			Wire.beginTransmission(_addr);
-			Wire.write((uint8_t)reg);
-			Wire.endTransmission();
-			Wire.requestFrom(_addr, 1);
-			return Wire.read();
+			BONK_PROFILE(Tmp411);
+			setPointer(reg);
+			this->bus().requestFrom(this->address(), 1);
+			return this->bus().read();
 		}
 		uint16_t readRegister16(Tmp411Register reg) {
-			Wire.beginTransmission(_addr);
-			Wire.write((uint8_t)reg);
-			Wire.endTransmission();
-			Wire.requestFrom(_addr, 2);
-			return (Wire.read() << 8) + Wire.read();
+			BONK_PROFILE(Tmp411);
+			setPointer(reg);
+			this->bus().requestFrom(this->address(), 2);
+			// two statements so the high byte is guaranteed to be read first.
+			uint16_t high = this->bus().read();
+			return (high << 8) + this->bus().read();
 		}
 	};
+
+	// address chosen at runtime, on Wire: Tmp411 thermometer(TMP411_ADDRESS);
+	typedef BasicTmp411<RuntimeI2cDevice> Tmp411;
 }
 
 #endif // HARDWARE_CONTROL_H_
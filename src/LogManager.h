@@ -5,6 +5,35 @@
 
 #include <SdFat.h>
 
+#include <stdio.h>      // for snprintf
+#include <string.h>
+
+#include "Profiler.h"
+#include "ShipReading.h"
+
+// where DEBUG messages go. The ship's data usually comes in on the same port.
+#ifndef BONK_DEBUG_SERIAL
+#define BONK_DEBUG_SERIAL Serial
+#endif
+
+// DEBUG messages wait here until the serial port has room for them.
+#ifndef BONK_DEBUG_TX_BYTES
+#define BONK_DEBUG_TX_BYTES 128
+#endif
+
+// room for ERROR and NOTIFY records in the black box. Each one takes 8 bytes
+// plus its message.
+#ifndef BONK_BLACK_BOX_BYTES
+#define BONK_BLACK_BOX_BYTES 256
+#endif
+
+// Defines a BlackBox that the C runtime doesn't zero at reset, so what's in
+// it is still there after a brownout or the watchdog. Put it at file scope:
+//
+//   BONK_BLACK_BOX(black_box);
+//   Bonk::LogManager log_manager(&black_box);
+#define BONK_BLACK_BOX(name) Bonk::BlackBox name __attribute__((section(".noinit")))
+
 namespace Bonk {
 
 enum class LogType {
@@ -14,31 +43,101 @@ enum class LogType {
     NOTIFY,
 };
 
+// ERROR and NOTIFY records that haven't been synced to the card yet, kept
+// where a reset won't clear them. It's a ring of records:
+//
+//   message length, LogType, millis() (4 bytes, little endian), message,
+//   two running sums of all that (Fletcher's checksum, mod 256)
+//
+// from tail up to head, oldest first. A record is written before head moves
+// past it, so one cut off by a reset is never read back. After a power-on,
+// the RAM is junk: the magic, the complemented copies of tail and head, and
+// the checksums are what tell the two apart. A pointer and its copy are
+// separate stores, so a reset between them leaves the copy one move behind;
+// either value is a record boundary, and the one the records lead to wins.
+struct BlackBox {
+    uint32_t magic;
+    uint16_t tail;
+    uint16_t tail_check; // ~tail
+    uint16_t head;
+    uint16_t head_check; // ~head
+    uint8_t data[BONK_BLACK_BOX_BYTES];
+};
+
+const uint32_t BLACK_BOX_MAGIC = 0x58424b42; // "BKBX"
+const uint8_t BLACK_BOX_RECORD_OVERHEAD = 8;
+
 class LogManager {
   public:
-    LogManager() { }
+    // black_box: where to keep ERROR and NOTIFY records until they're synced
+    // to the card, usually one defined with BONK_BLACK_BOX. Nothing touches
+    // it before begin().
+    LogManager(BlackBox* black_box = nullptr):
+        debug_head_(0), debug_count_(0), debug_dropped_(0),
+        black_box_(black_box), black_box_ready_(false), black_box_recovered_(0) { }
 
+    // Opens the files. If there's a black box and it has records from before
+    // a reset, they're written to the log first, after a NOTIFY line saying
+    // how many there were. They keep their old millis() stamps.
     bool begin(const char* log_path, const char* data_path) {
 	    if (log_path == nullptr) {
 		    return false;
 	    }
 	    log_path_ = log_path;
 	    log_file_.open(log_path_, O_WRITE | O_APPEND | O_CREAT);
+	    if (black_box_ != nullptr) {
+		    black_box_recovered_ = replay_black_box(false);
+		    if (black_box_recovered_ > 0) {
+			    char line[48];
+			    snprintf(line, sizeof(line), "recovered %u records from before reset",
+				     (unsigned)black_box_recovered_);
+			    print_tag(LogType::NOTIFY, millis());
+			    log_file_.write(line);
+			    log_file_.write('\n');
+			    replay_black_box(true);
+			    log_file_.sync();
+		    }
+		    clear_black_box();
+		    black_box_ready_ = true;
+	    }
+	    if (data_path != nullptr) {
+		    data_file_.open(data_path, O_WRITE | O_APPEND | O_CREAT);
+		    if (data_file_.fileSize() == 0) {
+			    data_file_.write(READING_CSV_HEADER);
+			    data_file_.write('\n');
+		    }
+	    }
+	    return true;
+    }
+
+    // appends the reading to the data file as a CSV row. Columns are in
+    // ShipReadingFields.h, and the header is written when the file is new.
+    size_t log_reading(const ShipReading& reading) {
+	    BONK_PROFILE(LogWrite);
+	    char row[256];
+	    int n = formatReadingCsv(reading, row, sizeof(row) - 1);
+	    if (n < 0 || (size_t)n >= sizeof(row) - 1) {
+		    return 0;
+	    }
+	    row[n++] = '\n';
+	    return data_file_.write((const uint8_t *)row, n);
     }
 
     size_t log(LogType level, const String& msg) {
 	    return LogManager::log(level, msg.c_str());
     }
     size_t log(LogType level, const uint8_t* buf, size_t size) {
-	    size_t bytes = print_tag(level);
+	    BONK_PROFILE(LogWrite);
+	    size_t bytes = print_tag(level, millis());
 	    switch (level) {
 	    case LogType::DEBUG:
-		    bytes += Serial.write(buf, size);
-		    bytes += Serial.println();
+		    bytes += queue_debug(buf, size);
 		    break;
-	    case LogType::WARNING:
 	    case LogType::ERROR:
 	    case LogType::NOTIFY:
+		    keep(level, buf, size);
+		    // fall through
+	    case LogType::WARNING:
 		    bytes += log_file_.write(buf, size);
 		    bytes += log_file_.write('\n');
 		    break;
@@ -47,42 +146,269 @@ class LogManager {
     }
     size_t log(LogType level, const char* msg) {
 	    if (msg == nullptr) return 0;
-	    size_t bytes = print_tag(level);
+	    BONK_PROFILE(LogWrite);
+	    size_t bytes = print_tag(level, millis());
 	    switch (level) {
 	    case LogType::DEBUG:
-		    bytes += Serial.println(msg);
+		    bytes += queue_debug((const uint8_t *)msg, strlen(msg));
 		    break;
-	    case LogType::WARNING:
 	    case LogType::ERROR:
 	    case LogType::NOTIFY:
+		    keep(level, (const uint8_t *)msg, strlen(msg));
+		    // fall through
+	    case LogType::WARNING:
 		    bytes += log_file_.write(msg);
 		    bytes += log_file_.write('\n');
 		    break;
 	    }
 	    return bytes;
     }
+
+    // Syncs the log file to the card, which empties the black box. Call it
+    // now and then from a task, off the hot path; until then the black box
+    // is what keeps ERROR and NOTIFY lines safe from a reset.
+    void sync() {
+	    log_file_.sync();
+	    if (black_box_ready_) {
+		    clear_black_box();
+	    }
+    }
+
+    // records begin() found in the black box and wrote to the log
+    uint16_t black_box_recovered() const {
+	    return black_box_recovered_;
+    }
+
+    // Sends as much queued DEBUG output as the serial port will take without
+    // blocking, and returns how much that was. Logging a DEBUG message
+    // calls it, and so does Runtime between chunks if you give it this with
+    // drainDebugOutput(); otherwise call it from loop().
+    size_t flush_debug() {
+	    size_t sent = 0;
+	    int room;
+	    while (debug_count_ > 0 && (room = BONK_DEBUG_SERIAL.availableForWrite()) > 0) {
+		    // up to the end of the ring, then around again
+		    size_t start = (debug_head_ + BONK_DEBUG_TX_BYTES - debug_count_) % BONK_DEBUG_TX_BYTES;
+		    size_t n = BONK_DEBUG_TX_BYTES - start;
+		    if (n > debug_count_) {
+			    n = debug_count_;
+		    }
+		    if (n > (size_t)room) {
+			    n = room;
+		    }
+		    BONK_DEBUG_SERIAL.write(debug_tx_ + start, n);
+		    debug_count_ -= n;
+		    sent += n;
+	    }
+	    return sent;
+    }
+
+    // bytes of DEBUG output thrown away because the queue was full. Whole
+    // messages are dropped, never the middle of one.
+    uint32_t debug_dropped_bytes() const {
+	    return debug_dropped_;
+    }
+
+#ifdef BONK_PROFILING
+    // writes the profiling table, one line per probe, at the given level.
+    void log_profile(LogType level = LogType::NOTIFY) {
+	    char line[80];
+	    for (uint8_t i = 0; i < NUM_PROFILE_PROBES; i++) {
+		    // copy first, since logging updates the LogWrite entry
+		    ProfileEntry entry = profileTable()[i];
+		    snprintf(line, sizeof(line), "profile %s calls=%lu total_us=%lu max_us=%lu",
+			     profileProbeName((ProfileProbe)i),
+			     (unsigned long)entry.calls,
+			     (unsigned long)entry.totalMicros,
+			     (unsigned long)entry.maxMicros);
+		    log(level, line);
+	    }
+    }
+#endif
   private:
-    size_t print_tag(LogType level) {
-	    String msg;
+    // queues a line of DEBUG output, if it all fits, and sends what it can.
+    // Returns the bytes queued.
+    size_t queue_debug(const uint8_t* buf, size_t size) {
+	    if (size + 2 > (size_t)(BONK_DEBUG_TX_BYTES - debug_count_)) {
+		    debug_dropped_ += size + 2;
+		    flush_debug();
+		    return 0;
+	    }
+	    for (size_t i = 0; i < size + 2; i++) {
+		    debug_tx_[debug_head_] = i < size ? buf[i] : "\r\n"[i - size];
+		    debug_head_ = (debug_head_ + 1) % BONK_DEBUG_TX_BYTES;
+	    }
+	    debug_count_ += size + 2;
+	    flush_debug();
+	    return size + 2;
+    }
+
+    // Adds a record to the black box, throwing out the oldest ones to make
+    // room. Long messages are cut short.
+    void keep(LogType level, const uint8_t* buf, size_t size) {
+	    if (!black_box_ready_) {
+		    return;
+	    }
+	    const size_t max_size = BONK_BLACK_BOX_BYTES - 1 - BLACK_BOX_RECORD_OVERHEAD;
+	    if (size > max_size) {
+		    size = max_size;
+	    }
+	    if (size > 255) {
+		    size = 255;
+	    }
+	    BlackBox& box = *black_box_;
+	    while ((size_t)(BONK_BLACK_BOX_BYTES - 1 - black_box_used()) < size + BLACK_BOX_RECORD_OVERHEAD) {
+		    uint16_t tail = (box.tail + box.data[box.tail] + BLACK_BOX_RECORD_OVERHEAD) % BONK_BLACK_BOX_BYTES;
+		    box.tail = tail;
+		    box.tail_check = ~tail;
+	    }
+	    uint16_t at = box.head;
+	    uint8_t sum = 0, sum_of_sums = 0;
+	    unsigned long now = millis();
+	    uint8_t header[6] = {
+		    (uint8_t)size, (uint8_t)level,
+		    (uint8_t)now, (uint8_t)(now >> 8), (uint8_t)(now >> 16), (uint8_t)(now >> 24),
+	    };
+	    for (uint8_t i = 0; i < sizeof(header); i++) {
+		    put_black_box(at, header[i], sum, sum_of_sums);
+	    }
+	    for (size_t i = 0; i < size; i++) {
+		    put_black_box(at, buf[i], sum, sum_of_sums);
+	    }
+	    box.data[at] = sum;
+	    box.data[(at + 1) % BONK_BLACK_BOX_BYTES] = sum_of_sums;
+	    at = (at + 2) % BONK_BLACK_BOX_BYTES;
+	    // only now is the record there to be found
+	    box.head = at;
+	    box.head_check = ~at;
+    }
+
+    void put_black_box(uint16_t& at, uint8_t byte, uint8_t& sum, uint8_t& sum_of_sums) {
+	    black_box_->data[at] = byte;
+	    sum += byte;
+	    sum_of_sums += sum;
+	    at = (at + 1) % BONK_BLACK_BOX_BYTES;
+    }
+
+    uint16_t black_box_used() const {
+	    return (black_box_->head + BONK_BLACK_BOX_BYTES - black_box_->tail) % BONK_BLACK_BOX_BYTES;
+    }
+
+    // Counts the good records in the black box, oldest first, stopping at
+    // the first bad one, and writes them to the log file if write is set.
+    // Returns 0 if the black box isn't one at all.
+    uint16_t replay_black_box(bool write) {
+	    const BlackBox& box = *black_box_;
+	    if (box.magic != BLACK_BOX_MAGIC) {
+		    return 0;
+	    }
+	    // if a reset cut a move of tail or head short, the pointer is the new
+	    // value (or, torn itself, junk) and the check still the old one
+	    const uint16_t tails[2] = { box.tail, (uint16_t)~box.tail_check };
+	    const uint16_t heads[2] = { box.head, (uint16_t)~box.head_check };
+	    bool torn = tails[0] != tails[1] || heads[0] != heads[1];
+	    for (uint8_t t = 0; t < 2; t++) {
+		    for (uint8_t h = 0; h < 2; h++) {
+			    if ((t == 1 && tails[1] == tails[0]) || (h == 1 && heads[1] == heads[0]) ||
+				tails[t] >= BONK_BLACK_BOX_BYTES || heads[h] >= BONK_BLACK_BOX_BYTES) {
+				    continue;
+			    }
+			    uint16_t left;
+			    uint16_t records = walk_black_box(tails[t], heads[h], false, left);
+			    // a torn pair is only trusted if its records lead right to head
+			    if (!torn || left == 0) {
+				    return write ? walk_black_box(tails[t], heads[h], true, left) : records;
+			    }
+		    }
+	    }
+	    return 0;
+    }
+
+    // replay_black_box() for the records from tail to head. left is set to
+    // the bytes after the last good one.
+    uint16_t walk_black_box(uint16_t tail, uint16_t head, bool write, uint16_t& left) {
+	    const BlackBox& box = *black_box_;
+	    uint16_t records = 0;
+	    uint16_t at = tail;
+	    left = (head + BONK_BLACK_BOX_BYTES - tail) % BONK_BLACK_BOX_BYTES;
+	    while (left > 0) {
+		    uint16_t size = box.data[at] + BLACK_BOX_RECORD_OVERHEAD;
+		    if (size > left) {
+			    break;
+		    }
+		    uint8_t sum = 0, sum_of_sums = 0;
+		    for (uint16_t i = 0; i < size - 2; i++) {
+			    sum += box.data[(at + i) % BONK_BLACK_BOX_BYTES];
+			    sum_of_sums += sum;
+		    }
+		    uint8_t level = box.data[(at + 1) % BONK_BLACK_BOX_BYTES];
+		    if (sum != box.data[(at + size - 2) % BONK_BLACK_BOX_BYTES] ||
+			sum_of_sums != box.data[(at + size - 1) % BONK_BLACK_BOX_BYTES] ||
+			level > (uint8_t)LogType::NOTIFY) {
+			    break;
+		    }
+		    if (write) {
+			    unsigned long stamp = 0;
+			    for (uint8_t i = 0; i < 4; i++) {
+				    stamp |= (unsigned long)box.data[(at + 2 + i) % BONK_BLACK_BOX_BYTES] << (8 * i);
+			    }
+			    print_tag((LogType)level, stamp);
+			    // the message, which might go around the end of the ring
+			    uint16_t start = (at + 6) % BONK_BLACK_BOX_BYTES;
+			    uint16_t n = box.data[at];
+			    uint16_t first = BONK_BLACK_BOX_BYTES - start < n ? BONK_BLACK_BOX_BYTES - start : n;
+			    log_file_.write(box.data + start, first);
+			    if (first < n) {
+				    log_file_.write(box.data, n - first);
+			    }
+			    log_file_.write('\n');
+		    }
+		    records++;
+		    at = (at + size) % BONK_BLACK_BOX_BYTES;
+		    left -= size;
+	    }
+	    return records;
+    }
+
+    void clear_black_box() {
+	    BlackBox& box = *black_box_;
+	    box.tail = box.head = 0;
+	    box.tail_check = box.head_check = ~0;
+	    box.magic = BLACK_BOX_MAGIC;
+    }
+
+    // writes the level's tag and at, a millis() reading, to the log file
+    size_t print_tag(LogType level, unsigned long at) {
+	    const char* tag;
 	    switch (level) {
 	    case LogType::DEBUG:
 		    return 0;
 	    case LogType::WARNING:
-		    msg = "[WARN] ";
+		    tag = "[WARN]";
 		    break;
 	    case LogType::ERROR:
-		    msg = "[ERR] ";
+		    tag = "[ERR]";
 		    break;
 	    case LogType::NOTIFY:
-		    msg = "[NOTIFY] ";
+	    default:
+		    tag = "[NOTIFY]";
 		    break;
 	    }
-	    msg += millis() + ": ";
-	    return log_file_.write(msg.c_str());
+	    char msg[32];
+	    snprintf(msg, sizeof(msg), "%s %lu: ", tag, at);
+	    return log_file_.write(msg);
     }
 	
     const char* log_path_;
     FatFile log_file_;
+    FatFile data_file_;
+    uint8_t debug_tx_[BONK_DEBUG_TX_BYTES];
+    uint16_t debug_head_;  // where the next byte goes
+    uint16_t debug_count_; // bytes waiting to be sent
+    uint32_t debug_dropped_;
+    BlackBox* black_box_;
+    bool black_box_ready_; // begin() has checked it, and it's ours now
+    uint16_t black_box_recovered_;
 };  // class LogManager
 
 }   // BONK namespace
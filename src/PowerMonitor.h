@@ -0,0 +1,193 @@
+#ifndef BONK_POWER_MONITOR_H
+#define BONK_POWER_MONITOR_H
+
+#include <stdint.h>
+
+#include "HardwareControl.h"
+
+namespace Bonk {
+
+	enum class Ina226Register {
+		CONFIG        = 0x00,
+		SHUNT_VOLTAGE = 0x01,
+		BUS_VOLTAGE   = 0x02,
+		POWER         = 0x03,
+		CURRENT       = 0x04,
+		CALIBRATION   = 0x05,
+		MASK_ENABLE   = 0x06,
+		ALERT_LIMIT   = 0x07,
+	};
+
+	// Integer scale factors for an INA226, all worked out by the compiler. The
+	// current LSB is rounded up to a whole number of microamps, so converting a
+	// reading is a single integer multiply instead of a trip through soft-float.
+	template <uint16_t ShuntMilliohms, uint16_t MaxCurrentMilliamps>
+	struct Ina226Scale {
+		static constexpr uint16_t currentLsbMicroamps =
+			((uint32_t)MaxCurrentMilliamps * 1000 + 32767) / 32768;
+		// 0.00512 / (current LSB * shunt), from the datasheet, in our units.
+		static constexpr uint16_t calibration =
+			5120000UL / ((uint32_t)currentLsbMicroamps * ShuntMilliohms);
+		static constexpr uint32_t powerLsbMicrowatts = 25UL * currentLsbMicroamps;
+		// 2.5uV per LSB, and a milliamp through a milliohm is a microvolt.
+		static constexpr uint16_t shuntLimitRaw(uint16_t limitMilliamps) {
+			return (uint32_t)limitMilliamps * ShuntMilliohms * 2 / 5;
+		}
+
+		static_assert(5120000UL / ((uint32_t)currentLsbMicroamps * ShuntMilliohms) <= 0x7FFF,
+			      "shunt and current range too small for the INA226 to calibrate");
+		static_assert(calibration > 0, "shunt and current range too large for the INA226");
+	};
+
+	// Running statistics over every sample since begin() or resetStats().
+	struct PowerStats {
+		uint32_t samples;
+		int32_t minCurrentMicroamps;
+		int32_t maxCurrentMicroamps;
+		int64_t currentSumMicroamps; // divide by samples for the mean
+		uint16_t minBusMillivolts;
+		uint16_t maxBusMillivolts;
+		uint32_t maxPowerMicrowatts;
+	};
+
+	// Power telemetry from an INA226 without any floats: raw register reads
+	// scaled by constants from Ina226Scale, plus min/max/mean and integrated
+	// energy. Sets up the chip itself, so use it instead of Main226/Boost226,
+	// not alongside them. Device is an I2cDevice.
+	template <typename Device, uint16_t ShuntMilliohms, uint16_t MaxCurrentMilliamps,
+		  uint16_t LimitMilliamps = 0>
+	class PowerMonitor: private Device {
+	public:
+		typedef Ina226Scale<ShuntMilliohms, MaxCurrentMilliamps> Scale;
+		static const uint8_t NO_ALERT_PIN = 0xFF;
+
+		// alertPin is the Arduino pin wired to the INA226's (active-low) ALERT
+		// output, if any. With it, overLimit() costs nothing until the chip
+		// actually raises an alert.
+		PowerMonitor(uint8_t alertPin = NO_ALERT_PIN): _alertPin(alertPin) { }
+
+		void begin() {
+			// same conversion settings as Main226 and Boost226: 4 averages,
+			// 140us conversions, shunt and bus continuous.
+			writeRegister(Ina226Register::CONFIG, (0b001 << 9) | 0b111);
+			writeRegister(Ina226Register::CALIBRATION, Scale::calibration);
+			if (LimitMilliamps > 0) {
+				writeRegister(Ina226Register::ALERT_LIMIT, Scale::shuntLimitRaw(LimitMilliamps));
+				// shunt over-limit, latched until the mask/enable register is read.
+				writeRegister(Ina226Register::MASK_ENABLE, MASK_SOL | MASK_LEN);
+			}
+			if (_alertPin != NO_ALERT_PIN) {
+				pinMode(_alertPin, INPUT_PULLUP);
+			}
+			_lastSampleMillis = millis();
+			resetStats();
+		}
+
+		// Read bus voltage and current (power is computed from those, the same
+		// way the chip does it), and fold them into the statistics. Call this
+		// however often you want telemetry.
+		void sample() {
+			_busRaw = readRegister(Ina226Register::BUS_VOLTAGE);
+			_currentRaw = readRegister(Ina226Register::CURRENT);
+
+			unsigned long now = millis();
+			_energyMicrowattMillis += (uint64_t)powerMicrowatts() * (uint32_t)(now - _lastSampleMillis);
+			_lastSampleMillis = now;
+
+			int32_t current = currentMicroamps();
+			uint16_t bus = busMillivolts();
+			if (_stats.samples == 0 || current < _stats.minCurrentMicroamps) {
+				_stats.minCurrentMicroamps = current;
+			}
+			if (_stats.samples == 0 || current > _stats.maxCurrentMicroamps) {
+				_stats.maxCurrentMicroamps = current;
+			}
+			if (_stats.samples == 0 || bus < _stats.minBusMillivolts) {
+				_stats.minBusMillivolts = bus;
+			}
+			if (bus > _stats.maxBusMillivolts) {
+				_stats.maxBusMillivolts = bus;
+			}
+			if (powerMicrowatts() > _stats.maxPowerMicrowatts) {
+				_stats.maxPowerMicrowatts = powerMicrowatts();
+			}
+			_stats.currentSumMicroamps += current;
+			_stats.samples++;
+		}
+
+		// values as of the last sample()
+		uint16_t busMillivolts() const {
+			// 1.25mV per LSB
+			return ((uint32_t)_busRaw * 5) >> 2;
+		}
+		int32_t currentMicroamps() const {
+			return (int32_t)_currentRaw * Scale::currentLsbMicroamps;
+		}
+		uint32_t powerMicrowatts() const {
+			uint16_t magnitude = _currentRaw < 0 ? -_currentRaw : _currentRaw;
+			// current * voltage / 20000 is the power register, times 25 LSBs.
+			return (uint32_t)magnitude * _busRaw / 800 * Scale::currentLsbMicroamps;
+		}
+
+		const PowerStats& stats() const {
+			return _stats;
+		}
+		int32_t meanCurrentMicroamps() const {
+			return _stats.samples == 0 ? 0 : _stats.currentSumMicroamps / _stats.samples;
+		}
+		// energy used since begin(), in thousandths of a milliwatt-hour.
+		uint32_t energyMicrowattHours() const {
+			return _energyMicrowattMillis / 3600000;
+		}
+		void resetStats() {
+			_stats = { 0, 0, 0, 0, 0, 0, 0 };
+			_energyMicrowattMillis = 0;
+		}
+
+		// true if the current has gone over LimitMilliamps since the last
+		// check. With an alert pin, the chip is only asked once the pin is
+		// pulled low; otherwise this is one register read per call.
+		bool overLimit() {
+			if (_alertPin != NO_ALERT_PIN && digitalRead(_alertPin) == HIGH) {
+				return false;
+			}
+			// reading mask/enable also releases the latched alert.
+			return readRegister(Ina226Register::MASK_ENABLE) & MASK_AFF;
+		}
+	private:
+		static const uint16_t MASK_SOL = 1 << 15;
+		static const uint16_t MASK_AFF = 1 << 4;
+		static const uint16_t MASK_LEN = 1 << 0;
+
+		uint8_t _alertPin;
+		uint16_t _busRaw;
+		int16_t _currentRaw;
+		unsigned long _lastSampleMillis;
+		uint64_t _energyMicrowattMillis;
+		PowerStats _stats;
+
+		void writeRegister(Ina226Register reg, uint16_t val) {
+			BONK_PROFILE(Ina226);
+			this->bus().beginTransmission(Device::address());
+			this->bus().write((uint8_t)reg);
+			this->bus().write((uint8_t)(val >> 8));
+			this->bus().write((uint8_t)val);
+			this->bus().endTransmission();
+		}
+		uint16_t readRegister(Ina226Register reg) {
+			BONK_PROFILE(Ina226);
+			this->bus().beginTransmission(Device::address());
+			this->bus().write((uint8_t)reg);
+			this->bus().endTransmission();
+			this->bus().requestFrom(Device::address(), 2);
+			uint16_t high = this->bus().read();
+			return (high << 8) | this->bus().read();
+		}
+	};
+
+	// the same shunts, ranges and limit as Main226::begin() and Boost226::begin().
+	typedef PowerMonitor<I2cDevice<BONK_MAIN226_ADDRESS>, 50, 2000, 900> MainPowerMonitor;
+	typedef PowerMonitor<I2cDevice<BONK_BOOST226_ADDRESS>, 50, 1000> BoostPowerMonitor;
+}
+
+#endif // BONK_POWER_MONITOR_H
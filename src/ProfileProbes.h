@@ -0,0 +1,8 @@
+BONK_PROFILE_PROBE(Parse)
+BONK_PROFILE_PROBE(EventDispatch)
+BONK_PROFILE_PROBE(LogWrite)
+BONK_PROFILE_PROBE(EepromWrite)
+BONK_PROFILE_PROBE(SdFlush)
+BONK_PROFILE_PROBE(Pca9557)
+BONK_PROFILE_PROBE(Tmp411)
+BONK_PROFILE_PROBE(Ina226)
@@ -0,0 +1,82 @@
+#ifndef BONK_PROFILER_H
+#define BONK_PROFILER_H
+
+// Scoped timing probes for the framework's own subsystems. Define
+// BONK_PROFILING before including BonkFramework.h to turn them on; otherwise
+// BONK_PROFILE(...) expands to nothing and none of this is compiled in.
+
+#ifdef BONK_PROFILING
+
+#include <stdint.h>
+
+namespace Bonk {
+
+	enum class ProfileProbe {
+#define BONK_PROFILE_PROBE(probe) probe,
+#include "ProfileProbes.h"
+#undef BONK_PROFILE_PROBE
+	};
+
+	const uint8_t NUM_PROFILE_PROBES = 0
+#define BONK_PROFILE_PROBE(probe) + 1
+#include "ProfileProbes.h"
+#undef BONK_PROFILE_PROBE
+		;
+
+	struct ProfileEntry {
+		uint32_t calls;
+		uint32_t totalMicros;
+		uint32_t maxMicros;
+	};
+
+	// one entry per probe, in static memory. A function-local static so that
+	// the header can be included from more than one file.
+	inline ProfileEntry *profileTable() {
+		static ProfileEntry table[NUM_PROFILE_PROBES];
+		return table;
+	}
+
+	inline const char *profileProbeName(ProfileProbe probe) {
+		switch (probe) {
+#define BONK_PROFILE_PROBE(probe) case ProfileProbe::probe: return #probe;
+#include "ProfileProbes.h"
+#undef BONK_PROFILE_PROBE
+		}
+		return "";
+	}
+
+	inline void resetProfile() {
+		for (uint8_t i = 0; i < NUM_PROFILE_PROBES; i++) {
+			profileTable()[i] = { 0, 0, 0 };
+		}
+	}
+
+	// times from construction to destruction, and adds it to the probe's entry.
+	class ProfileScope {
+	public:
+		ProfileScope(ProfileProbe probe): _entry(profileTable()[(uint8_t)probe]),
+						  _start(micros()) { }
+		~ProfileScope() {
+			uint32_t elapsed = micros() - _start;
+			_entry.calls++;
+			_entry.totalMicros += elapsed;
+			if (elapsed > _entry.maxMicros) {
+				_entry.maxMicros = elapsed;
+			}
+		}
+	private:
+		ProfileEntry& _entry;
+		uint32_t _start;
+	};
+}
+
+// time the rest of the enclosing block under the named probe.
+#define BONK_PROFILE(probe) ::Bonk::ProfileScope _bonkProfileScope(::Bonk::ProfileProbe::probe)
+
+#else
+
+#define BONK_PROFILE(probe)
+
+#endif // BONK_PROFILING
+
+#endif // BONK_PROFILER_H
@@ -0,0 +1,233 @@
+#ifndef BONK_RUNTIME_H
+#define BONK_RUNTIME_H
+
+#include <stdint.h>
+
+#include "EventHandler.h"
+#include "LogManager.h"
+
+namespace Bonk {
+
+	// A piece of deferrable work run by Runtime: log flushes, flush_to_sd,
+	// sensor polls, the experiment itself. Anything that can take a while
+	// should be split up so that each runChunk() call does one bounded piece
+	// of it; Runtime reads the ship's serial data between chunks.
+	class Task {
+	public:
+		// do one chunk of work. Return true if there's more to do before the
+		// task is finished for this period.
+		virtual bool runChunk() = 0;
+	};
+
+	// A Task that's just a function, run to completion in one chunk.
+	class FunctionTask: public Task {
+	public:
+		FunctionTask(void (*function)()): _function(function) { }
+		bool runChunk() override {
+			_function();
+			return false;
+		}
+	private:
+		void (*_function)();
+	};
+
+	struct TaskStats {
+		uint16_t completions;
+		// times the task came due again before it had finished the last period
+		uint16_t deadlineMisses;
+		uint16_t maxChunkMillis;
+	};
+
+	struct RuntimeStats {
+		// times the gap between two EventHandler ticks exceeded the 75ms
+		// EventHandler needs to keep up with the ship
+		uint16_t ingestMisses;
+		uint16_t maxIngestGapMillis;
+		// loops that ran past their budget because a single chunk was too long
+		uint16_t overBudgetLoops;
+		uint16_t maxLoopMillis;
+	};
+
+	// Owns loop(): call tick() and nothing else from it. Reads the ship's data
+	// first thing and again between every chunk of every task, so the timing
+	// EventHandler needs is guaranteed by construction (as long as each chunk
+	// is short), and fills whatever is left of the per-loop budget with due
+	// tasks, most important first.
+	template <uint8_t MaxTasks = 8>
+	class Runtime {
+	public:
+		static const uint8_t MAX_INGEST_GAP_MILLIS = 75;
+
+		// budgetMillis: how long one tick() may spend on tasks before handing
+		// control back to the Arduino core.
+		Runtime(EventHandler& events, uint16_t budgetMillis = 20):
+			_events(events),
+			_budgetMillis(budgetMillis),
+			_numTasks(0),
+			_stats({ 0, 0, 0, 0 }),
+			_debugLog(nullptr) {
+#ifdef BONK_PROFILING
+			_profileLog = nullptr;
+#endif
+		}
+
+		// Add a task. Higher priorities run first. periodMillis is how often it
+		// becomes due; 0 means it's background work, run whenever there's
+		// budget to spare. Returns false if there's no room for it.
+		bool addTask(Task& task, uint8_t priority, uint16_t periodMillis) {
+			if (_numTasks == MaxTasks) {
+				return false;
+			}
+			TaskSlot& slot = _tasks[_numTasks++];
+			slot.task = &task;
+			slot.priority = priority;
+			slot.periodMillis = periodMillis;
+			slot.pending = false;
+			slot.stats = { 0, 0, 0 };
+			return true;
+		}
+
+		void begin() {
+			_events.begin();
+			unsigned long now = millis();
+			_lastIngestMillis = now;
+			for (uint8_t i = 0; i < _numTasks; i++) {
+				// everything is due right away
+				_tasks[i].releaseMillis = now - _tasks[i].periodMillis;
+			}
+		}
+
+		void tick() {
+			unsigned long start = millis();
+			ingest();
+#ifdef BONK_PROFILING
+			if (_profileLog != nullptr && _events.getLastReading().event == FlightEvent::MissionEnd) {
+				_profileLog->log_profile();
+				_profileLog = nullptr;
+			}
+#endif
+			releaseDueTasks(start);
+
+			TaskSlot *slot;
+			while ((slot = nextTask()) != nullptr && millis() - start < _budgetMillis) {
+				unsigned long chunkStart = millis();
+				bool more = slot->task->runChunk();
+				uint16_t chunkMillis = millis() - chunkStart;
+				if (chunkMillis > slot->stats.maxChunkMillis) {
+					slot->stats.maxChunkMillis = chunkMillis;
+				}
+				if (!more) {
+					slot->pending = false;
+					slot->stats.completions++;
+				}
+				ingest();
+			}
+
+			uint16_t loopMillis = millis() - start;
+			if (loopMillis > _budgetMillis) {
+				_stats.overBudgetLoops++;
+			}
+			if (loopMillis > _stats.maxLoopMillis) {
+				_stats.maxLoopMillis = loopMillis;
+			}
+		}
+
+		// send log's queued DEBUG output whenever the ship's data is read,
+		// as much as the serial port takes without blocking.
+		void drainDebugOutput(LogManager& log) {
+			_debugLog = &log;
+		}
+
+#ifdef BONK_PROFILING
+		// write the profiling table to log, once, when the ship reports
+		// MissionEnd.
+		void logProfileAtMissionEnd(LogManager& log) {
+			_profileLog = &log;
+		}
+#endif
+
+		const RuntimeStats& stats() const {
+			return _stats;
+		}
+		// stats for the i-th task added
+		const TaskStats& taskStats(uint8_t i) const {
+			return _tasks[i].stats;
+		}
+	private:
+		struct TaskSlot {
+			Task *task;
+			unsigned long releaseMillis; // start of the task's current period
+			uint16_t periodMillis;
+			uint8_t priority;
+			bool pending; // due, but not finished yet
+			TaskStats stats;
+		};
+
+		EventHandler& _events;
+		uint16_t _budgetMillis;
+		unsigned long _lastIngestMillis;
+		TaskSlot _tasks[MaxTasks];
+		uint8_t _numTasks;
+		RuntimeStats _stats;
+		LogManager *_debugLog;
+#ifdef BONK_PROFILING
+		LogManager *_profileLog;
+#endif
+
+		void ingest() {
+			unsigned long now = millis();
+			uint16_t gap = now - _lastIngestMillis;
+			if (gap > MAX_INGEST_GAP_MILLIS) {
+				_stats.ingestMisses++;
+			}
+			if (gap > _stats.maxIngestGapMillis) {
+				_stats.maxIngestGapMillis = gap;
+			}
+			_events.tick();
+			if (_debugLog != nullptr) {
+				_debugLog->flush_debug();
+			}
+			_lastIngestMillis = now;
+		}
+
+		void releaseDueTasks(unsigned long now) {
+			for (uint8_t i = 0; i < _numTasks; i++) {
+				TaskSlot& slot = _tasks[i];
+				if (slot.periodMillis == 0) {
+					slot.pending = true;
+					continue;
+				}
+				if (now - slot.releaseMillis < slot.periodMillis) {
+					continue;
+				}
+				if (slot.pending) {
+					slot.stats.deadlineMisses++;
+				}
+				slot.pending = true;
+				// skip whole periods we slept through rather than running them
+				// back to back.
+				slot.releaseMillis += (now - slot.releaseMillis) / slot.periodMillis * slot.periodMillis;
+			}
+		}
+
+		// highest priority pending task; periodic tasks before background
+		// ones of the same priority, then in the order they were added.
+		TaskSlot *nextTask() {
+			TaskSlot *best = nullptr;
+			for (uint8_t i = 0; i < _numTasks; i++) {
+				TaskSlot& slot = _tasks[i];
+				if (!slot.pending) {
+					continue;
+				}
+				if (best == nullptr ||
+				    slot.priority > best->priority ||
+				    (slot.priority == best->priority && best->periodMillis == 0 && slot.periodMillis != 0)) {
+					best = &slot;
+				}
+			}
+			return best;
+		}
+	};
+}
+
+#endif // BONK_RUNTIME_H
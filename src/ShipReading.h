@@ -0,0 +1,177 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+#ifndef BONK_SHIP_READING_H
+#define BONK_SHIP_READING_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+namespace Bonk {
+
+  enum class FlightEvent {
+#define BONK_FLIGHT_EVENT(blah, flightEvent) flightEvent,
+#include "FlightEvents.h"
+#undef BONK_FLIGHT_EVENT
+  };
+
+  // AVR, as an 8-bit architecture, aligns fields to 1 byte anyway. The
+  // attribute just makes absolutely sure. Fields and units are in
+  // ShipReadingFields.h.
+  typedef struct __attribute__((packed)) ShipReading {
+#define BONK_READING_FIELD(member, Name, type, decimals) type member;
+#include "ShipReadingFields.h"
+#undef BONK_READING_FIELD
+    FlightEvent event;
+  } ShipReading;
+
+  // ShipReading's fields, in order (not including the event).
+  enum class ReadingField : uint8_t {
+#define BONK_READING_FIELD(member, Name, type, decimals) Name,
+#include "ShipReadingFields.h"
+#undef BONK_READING_FIELD
+  };
+
+  const uint8_t NUM_READING_FIELDS = 0
+#define BONK_READING_FIELD(member, Name, type, decimals) + 1
+#include "ShipReadingFields.h"
+#undef BONK_READING_FIELD
+    ;
+  // fields in a packet on the wire, including the flight event
+  const uint8_t NUM_FIELDS = 1 + NUM_READING_FIELDS;
+
+  inline char flightEventChar(FlightEvent event) {
+    switch (event) {
+#define BONK_FLIGHT_EVENT(eventChar, flightEvent) case FlightEvent::flightEvent: return eventChar;
+#include "FlightEvents.h"
+#undef BONK_FLIGHT_EVENT
+    }
+    return '?';
+  }
+
+  // false if c isn't a known flight event character
+  inline bool flightEventFromChar(char c, FlightEvent& out) {
+    switch (c) {
+#define BONK_FLIGHT_EVENT(eventChar, flightEvent) case eventChar: out = FlightEvent::flightEvent; return true;
+#include "FlightEvents.h"
+#undef BONK_FLIGHT_EVENT
+    }
+    return false;
+  }
+
+  // a field's value, in the units of ShipReading. Bools are 0 or 1.
+  inline int32_t readingField(const ShipReading& reading, ReadingField field) {
+    switch (field) {
+#define BONK_READING_FIELD(member, Name, type, decimals) case ReadingField::Name: return reading.member;
+#include "ShipReadingFields.h"
+#undef BONK_READING_FIELD
+    }
+    return 0;
+  }
+
+  inline void setReadingField(ShipReading& reading, ReadingField field, int32_t value) {
+    switch (field) {
+#define BONK_READING_FIELD(member, Name, type, decimals) case ReadingField::Name: reading.member = value; break;
+#include "ShipReadingFields.h"
+#undef BONK_READING_FIELD
+    }
+  }
+
+  inline const char *readingFieldName(ReadingField field) {
+    switch (field) {
+#define BONK_READING_FIELD(member, Name, type, decimals) case ReadingField::Name: return #member;
+#include "ShipReadingFields.h"
+#undef BONK_READING_FIELD
+    }
+    return "?";
+  }
+
+  // Binary records: the event character, then each field little-endian, int32_ts
+  // as 4 bytes and bools as 1.
+  inline uint8_t *encodeField(uint8_t *out, int32_t value) {
+    for (uint8_t i = 0; i < 4; i++) {
+      *out++ = (uint32_t)value >> (8 * i);
+    }
+    return out;
+  }
+  inline uint8_t *encodeField(uint8_t *out, bool value) {
+    *out++ = value;
+    return out;
+  }
+  // the second argument just picks the type
+  inline int32_t decodeField(const uint8_t *&in, int32_t) {
+    uint32_t raw = 0;
+    for (uint8_t i = 0; i < 4; i++) {
+      raw |= (uint32_t)*in++ << (8 * i);
+    }
+    return (int32_t)raw;
+  }
+  inline bool decodeField(const uint8_t *&in, bool) {
+    return *in++ != 0;
+  }
+  constexpr uint8_t recordFieldSize(int32_t) { return 4; }
+  constexpr uint8_t recordFieldSize(bool) { return 1; }
+
+  const uint8_t READING_RECORD_SIZE = 1
+#define BONK_READING_FIELD(member, Name, type, decimals) + recordFieldSize((type)0)
+#include "ShipReadingFields.h"
+#undef BONK_READING_FIELD
+    ;
+
+  // writes READING_RECORD_SIZE bytes
+  inline void encodeReading(const ShipReading& reading, uint8_t *out) {
+    *out++ = flightEventChar(reading.event);
+#define BONK_READING_FIELD(member, Name, type, decimals) out = encodeField(out, reading.member);
+#include "ShipReadingFields.h"
+#undef BONK_READING_FIELD
+  }
+
+  // false if the record's event is garbage
+  inline bool decodeReading(const uint8_t *in, ShipReading& out) {
+    FlightEvent event;
+    if (!flightEventFromChar(*in++, event)) {
+      return false;
+    }
+    out.event = event;
+#define BONK_READING_FIELD(member, Name, type, decimals) out.member = decodeField(in, (type)0);
+#include "ShipReadingFields.h"
+#undef BONK_READING_FIELD
+    return true;
+  }
+
+  // CSV, with the same fixed-point decimals as on the wire.
+  const char READING_CSV_HEADER[] = "event"
+#define BONK_READING_FIELD(member, Name, type, decimals) "," #member
+#include "ShipReadingFields.h"
+#undef BONK_READING_FIELD
+    ;
+
+  inline int formatField(char *buf, size_t size, int32_t value, uint8_t decimals) {
+    if (decimals == 0) {
+      return snprintf(buf, size, ",%ld", (long)value);
+    }
+    unsigned long scale = 1;
+    for (uint8_t i = 0; i < decimals; i++) {
+      scale *= 10;
+    }
+    unsigned long magnitude = value < 0 ? -(unsigned long)value : (unsigned long)value;
+    return snprintf(buf, size, ",%s%lu.%0*lu", value < 0 ? "-" : "",
+                    magnitude / scale, (int)decimals, magnitude % scale);
+  }
+  inline int formatField(char *buf, size_t size, bool value, uint8_t decimals) {
+    return snprintf(buf, size, value ? ",1" : ",0");
+  }
+
+  // formats one CSV row, without a newline, like snprintf. 256 bytes is
+  // always enough.
+  inline int formatReadingCsv(const ShipReading& reading, char *buf, size_t size) {
+    int n = snprintf(buf, size, "%c", flightEventChar(reading.event));
+#define BONK_READING_FIELD(member, Name, type, decimals) \
+    n += formatField(buf + ((size_t)n < size ? n : size), (size_t)n < size ? size - n : 0, reading.member, decimals);
+#include "ShipReadingFields.h"
+#undef BONK_READING_FIELD
+    return n;
+  }
+}
+
+#endif // BONK_SHIP_READING_H
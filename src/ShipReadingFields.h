@@ -0,0 +1,36 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+// Every field of ShipReading, in the order the ship sends them (the flight
+// event character comes first, and isn't listed here). The struct, parser,
+// accessors, binary records and CSV logs are all generated from this list.
+//
+// BONK_READING_FIELD(member, Name, type, decimals)
+//   type:     int32_t (fixed point) or bool (0 or 1 on the wire). Not long,
+//             which is 64 bits on the host and 32 on the ship's side.
+//   decimals: fixed-point decimal places kept from the wire, so an int32_t
+//             with 6 decimals stores meters as micrometers, and tops out at
+//             about 2147 meters. Altitudes and velocities keep 3, so they go
+//             to 2147km and 2147km/s. The parser fails readings that don't
+//             fit.
+
+BONK_READING_FIELD(elapsed, Elapsed, int32_t, 0)         // milliseconds, unsigned
+BONK_READING_FIELD(altitude, Altitude, int32_t, 3)       // millimeters, unsigned
+BONK_READING_FIELD(gpsAltitude, GpsAltitude, int32_t, 3) // millimeters, unsigned
+BONK_READING_FIELD(vx, Vx, int32_t, 3)                   // millimeters/second
+BONK_READING_FIELD(vy, Vy, int32_t, 3)                   // millimeters/second
+BONK_READING_FIELD(vz, Vz, int32_t, 3)                   // millimeters/second
+BONK_READING_FIELD(aTotal, ATotal, int32_t, 6)           // unsigned, micrometers/second^2
+BONK_READING_FIELD(ax, Ax, int32_t, 6)                   // micrometers/second^2
+BONK_READING_FIELD(ay, Ay, int32_t, 6)                   // micrometers/second^2
+BONK_READING_FIELD(az, Az, int32_t, 6)                   // micrometers/second^2
+BONK_READING_FIELD(phi, Phi, int32_t, 6)                 // microradians
+BONK_READING_FIELD(theta, Theta, int32_t, 6)             // microradians
+BONK_READING_FIELD(psi, Psi, int32_t, 6)                 // microradians
+BONK_READING_FIELD(angx, AngX, int32_t, 6)               // microradians
+BONK_READING_FIELD(angy, AngY, int32_t, 6)               // microradians
+BONK_READING_FIELD(angz, AngZ, int32_t, 6)               // microradians
+BONK_READING_FIELD(launchImminent, LaunchImminent, bool, 0)
+BONK_READING_FIELD(drogueChuteImminent, DrogueChuteImminent, bool, 0)
+BONK_READING_FIELD(landingImminent, LandingImminent, bool, 0)
+BONK_READING_FIELD(chuteFaultWarning, ChuteFaultWarning, bool, 0)
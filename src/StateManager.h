@@ -5,18 +5,34 @@
 
 #include <stdint.h>     // for uint32_t, uint16_t, uint8_t
 
-#include <EEPROM.h>     // for access to Arduino EEPROM
 #include <SdFat.h>      // for access to SD card attached to Arduino
 
+#include "Profiler.h"   // for BONK_PROFILE
+#include "ShipReading.h" // for FlightEvent
+#include "StateStorage.h" // for EepromStorage
+
 namespace Bonk {
 
-// Manages the state of a Spaceduino and attached devices.
-template <typename S>
+// Manages the state of a Spaceduino and attached devices. Storage is where
+// the state records are kept (see StateStorage.h); the rest of this file
+// calls it the EEPROM, whatever it really is.
+template <typename S, typename Storage = EepromStorage>
 class StateManager {
   public:
     // Constructs a StateManager configured for type S.
-    StateManager() : write_size_(sizeof(S)),
-                     offset_(sizeof(uint32_t) + sizeof(uint16_t)) { }
+    StateManager() : StateManager(Storage()) { }
+
+    // Constructs a StateManager for type S that keeps it in storage.
+    explicit StateManager(const Storage& storage) :
+                     storage_(storage),
+                     write_size_(sizeof(S)),
+                     offset_(sizeof(uint32_t) + sizeof(uint16_t)),
+                     coalesce_millis_(0),
+                     commit_events_(0),
+                     last_event_(FlightEvent::NoneReached),
+                     writes_saved_(0),
+                     committed_crc_(0),
+                     dirty_(false) { }
 
     // Initializes StateManager with some initial state. Falls back
     // on fallback_state if EEPROM data are bad. Uses file at filepath
@@ -30,9 +46,41 @@ class StateManager {
 
     // sets the state and writes the update to the EEPROM. Returns true
     // if successful and false otherwise. Contents of state not guaranteed
-    // if false.
+    // if false. When coalescing, only the RAM copy is updated, and the
+    // EEPROM is written by commit().
     bool set_state(const S& state);
 
+    // Coalesce writes: set_state() only marks the state dirty, and it's
+    // written to the EEPROM once it's been dirty for dirty_millis (see
+    // tick()), on commit(), or on a commit_on() event, whichever's first.
+    // Only committed states survive a reset, with the same guarantees as
+    // ever. 0 (the default) writes every set_state() straight through.
+    void coalesce(uint16_t dirty_millis);
+
+    // commit when the ship first reports event, eg Liftoff or Safing. Pass
+    // every event to flight_event().
+    void commit_on(FlightEvent event);
+
+    // call with getLastReading().event after every reading, or from the
+    // event handlers. Commits on the first reading of a commit_on() event.
+    bool flight_event(FlightEvent event);
+
+    // commits if the state's been dirty for longer than the coalescing
+    // interval. Call it every loop(). Returns false if a commit failed.
+    bool tick();
+
+    // writes the state to the EEPROM now, if it's changed since the last
+    // commit. Returns true if successful and false otherwise.
+    bool commit();
+
+    // true if there are changes that haven't been committed
+    bool dirty() const;
+
+    // set_state() calls that didn't need an EEPROM write of their own,
+    // because a later one replaced them before the commit or they didn't
+    // change anything since the last commit.
+    uint32_t writes_saved() const;
+
     // Puts number of successful writes to EEPROM. Returns true
     // if manager is initialized, false otherwise.
     bool get_write_count(uint16_t& out) const;
@@ -51,8 +99,14 @@ class StateManager {
     // appends a state to the EEPROM
     bool write_state(const S& state);
 
+    // flushes to SD if the EEPROM is full, then appends state
+    bool commit_state(const S& state);
+
     // reads the last state from the EEPROM
-    bool read_state(S& state) const;
+    bool read_state(S& state);
+
+    // where the records go
+    Storage storage_;
 
     // number of written records
     uint16_t write_count_;
@@ -69,12 +123,32 @@ class StateManager {
     // current state
     S state_;
 
+    // coalescing interval, 0 to write through
+    uint16_t coalesce_millis_;
+
+    // bit per FlightEvent to commit on
+    uint16_t commit_events_;
+
+    // last event passed to flight_event
+    FlightEvent last_event_;
+
+    // millis() when the state became dirty
+    unsigned long dirty_since_;
+
+    uint32_t writes_saved_;
+
+    // crc32 of the last state that made it to the EEPROM
+    uint32_t committed_crc_;
+
+    // has state_ changed since it was last committed?
+    bool dirty_;
+
     // is the state manager initialized?
     bool initialized_;
 };  // StateManager class
 
-template <typename S>
-bool StateManager<S>::begin(const char* filepath, const S& fallback_state) {
+template <typename S, typename Storage>
+bool StateManager<S, Storage>::begin(const char* filepath, const S& fallback_state) {
     if (filepath == nullptr) {
         return false;
     }
@@ -84,53 +158,63 @@ bool StateManager<S>::begin(const char* filepath, const S& fallback_state) {
     // read crc and write count
     uint32_t crc;
     uint16_t writes;
-    uint32_t& ret_crc = EEPROM.get(0, crc);
-    uint16_t& ret_writes = EEPROM.get(sizeof(uint32_t), writes);
-
-    if (ret_crc != crc || ret_writes != writes) {
+    if (!storage_.begin() ||
+        !storage_.read(0, &crc, sizeof(crc)) ||
+        !storage_.read(sizeof(uint32_t), &writes, sizeof(writes))) {
         return false;
     }
 
-    if (writes == 0 || writes >= (EEPROM.length() - offset_) / write_size_) {
+    if (writes == 0 || writes > (storage_.size() - offset_) / write_size_) {
         // number of writes is weird, fallback on fallback_state
         write_count_ = 0;
-        // temporarily set initialized_ so that set_state doesn't choke
+        // temporarily set initialized_ so that commit_state doesn't choke
         initialized_ = true;
-        initialized_ = StateManager<S>::set_state(fallback_state);
+        initialized_ = StateManager::commit_state(fallback_state);
     } else {
         // writes are reasonable, pull state and check crc
         write_count_ = writes;
-        initialized_ = StateManager<S>::read_state(state_);
+        initialized_ = StateManager::read_state(state_);
         if (!initialized_) {
             // fallback on default_state, CRC likely failed
             // last write was bad, so overwrite it
             write_count_--;
             initialized_ = true;
-            initialized_ = StateManager<S>::set_state(fallback_state);
+            initialized_ = StateManager::commit_state(fallback_state);
         }
     }
     return initialized_;
 }
 
-template <typename S>
-bool StateManager<S>::read_state(S& state) const {
-    EEPROM.get(offset_ + write_size_ * (write_count_ - 1), state);
+template <typename S, typename Storage>
+bool StateManager<S, Storage>::read_state(S& state) {
     uint32_t crc;
-    uint32_t& ret_crc = EEPROM.get(0, crc);
-    return ret_crc == crc && StateManager::crc32(state) == crc;
+    if (!storage_.read(offset_ + (uint32_t)write_size_ * (write_count_ - 1), &state, sizeof(S)) ||
+        !storage_.read(0, &crc, sizeof(crc)) ||
+        StateManager::crc32(state) != crc) {
+        return false;
+    }
+    committed_crc_ = crc;
+    return true;
 }
 
-template <typename S>
-bool StateManager<S>::write_state(const S& state) {
+template <typename S, typename Storage>
+bool StateManager<S, Storage>::write_state(const S& state) {
+    BONK_PROFILE(EepromWrite);
     uint32_t crc = StateManager::crc32(const_cast<S&>(state));
-    EEPROM.put(offset_ + write_size_ * (write_count_++), state);
-    const uint16_t& ret_writes = EEPROM.put(sizeof(uint32_t), write_count_);
-    const uint32_t& ret_crc = EEPROM.put(0, crc);
-    return ret_writes == write_count_ && ret_crc == crc;
+    if (!storage_.write(offset_ + (uint32_t)write_size_ * write_count_, &state, sizeof(S))) {
+        return false;
+    }
+    write_count_++;
+    if (!storage_.write(sizeof(uint32_t), &write_count_, sizeof(write_count_)) ||
+        !storage_.write(0, &crc, sizeof(crc))) {
+        return false;
+    }
+    committed_crc_ = crc;
+    return true;
 }
 
-template <typename S>
-bool StateManager<S>::get_state(S& out) const {
+template <typename S, typename Storage>
+bool StateManager<S, Storage>::get_state(S& out) const {
     if (!initialized_) {
         return false;
     }
@@ -138,24 +222,100 @@ bool StateManager<S>::get_state(S& out) const {
     return true;
 }
 
-template <typename S>
-bool StateManager<S>::set_state(const S &state) {
+template <typename S, typename Storage>
+bool StateManager<S, Storage>::set_state(const S &state) {
     if (!initialized_) {
         return false;
     }
+    if (coalesce_millis_ == 0) {
+        return StateManager::commit_state(state);
+    }
+
+    if (dirty_) {
+        // whatever was pending won't be written now
+        writes_saved_++;
+    }
+    // compared with what's committed, not state_, so setting a state and
+    // then setting it back doesn't leave anything to write
+    if (StateManager::crc32(const_cast<S&>(state)) == committed_crc_) {
+        // and this one doesn't need writing either
+        writes_saved_++;
+        dirty_ = false;
+    } else if (!dirty_) {
+        dirty_ = true;
+        dirty_since_ = millis();
+    }
+    state_ = state;
+    return true;
+}
+
+template <typename S, typename Storage>
+bool StateManager<S, Storage>::commit_state(const S& state) {
     if (StateManager::filled() && !StateManager::flush_to_sd()) {
         return false;
     }
 
     if (StateManager::write_state(state)) {
         state_ = state;
+        dirty_ = false;
         return true;
     }
     return false;
 }
 
-template <typename S>
-bool StateManager<S>::get_write_count(uint16_t& out) const {
+template <typename S, typename Storage>
+void StateManager<S, Storage>::coalesce(uint16_t dirty_millis) {
+    coalesce_millis_ = dirty_millis;
+}
+
+template <typename S, typename Storage>
+void StateManager<S, Storage>::commit_on(FlightEvent event) {
+    commit_events_ |= 1 << (uint8_t)event;
+}
+
+template <typename S, typename Storage>
+bool StateManager<S, Storage>::flight_event(FlightEvent event) {
+    if (event == last_event_) {
+        return true;
+    }
+    last_event_ = event;
+    if (!(commit_events_ & (1 << (uint8_t)event))) {
+        return true;
+    }
+    return StateManager::commit();
+}
+
+template <typename S, typename Storage>
+bool StateManager<S, Storage>::tick() {
+    if (!dirty_ || millis() - dirty_since_ < coalesce_millis_) {
+        return true;
+    }
+    return StateManager::commit();
+}
+
+template <typename S, typename Storage>
+bool StateManager<S, Storage>::commit() {
+    if (!initialized_) {
+        return false;
+    }
+    if (!dirty_) {
+        return true;
+    }
+    return StateManager::commit_state(state_);
+}
+
+template <typename S, typename Storage>
+bool StateManager<S, Storage>::dirty() const {
+    return dirty_;
+}
+
+template <typename S, typename Storage>
+uint32_t StateManager<S, Storage>::writes_saved() const {
+    return writes_saved_;
+}
+
+template <typename S, typename Storage>
+bool StateManager<S, Storage>::get_write_count(uint16_t& out) const {
     if (!initialized_) {
         return false;
     }
@@ -163,19 +323,24 @@ bool StateManager<S>::get_write_count(uint16_t& out) const {
     return true;
 }
 
-template <typename S>
-bool StateManager<S>::flush_to_sd() {
+template <typename S, typename Storage>
+bool StateManager<S, Storage>::flush_to_sd() {
     // TODO: need some notion of SD file system - library global? or ref stored in class
     if (!initialized_) {
         return false;
     }
+    BONK_PROFILE(SdFlush);
 
     FatFile sf;
     if (!sf.open(state_file_path_, O_APPEND | O_WRITE)) {
         return false;
     }
-    for (uint16_t i = sizeof(uint32_t); i < offset_ + write_size_ * write_count_; i++) {
-        if (sf.write(EEPROM[i]) == 0) {
+    // the write count and records, a block at a time
+    uint8_t block[32];
+    uint32_t end = offset_ + (uint32_t)write_size_ * write_count_;
+    for (uint32_t i = sizeof(uint32_t); i < end; i += sizeof(block)) {
+        uint16_t n = end - i < sizeof(block) ? end - i : sizeof(block);
+        if (!storage_.read(i, block, n) || sf.write(block, n) != n) {
             return false;
         }
     }
@@ -183,13 +348,12 @@ bool StateManager<S>::flush_to_sd() {
     sf.close();
 
     write_count_ = 0;
-    const uint16_t& ret_writes = EEPROM.put(offset_, write_count_);
-    return ret_writes == write_count_;
+    return storage_.write(sizeof(uint32_t), &write_count_, sizeof(write_count_));
 }
 
 // code adapted from https://www.arduino.cc/en/Tutorial/EEPROMCrc
-template <typename S>
-uint32_t StateManager<S>::crc32(S& state) const {
+template <typename S, typename Storage>
+uint32_t StateManager<S, Storage>::crc32(S& state) const {
     constexpr uint32_t crc_table[16] = {
         0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
         0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
@@ -210,9 +374,9 @@ uint32_t StateManager<S>::crc32(S& state) const {
     return crc;
 }
 
-template <typename S>
-bool StateManager<S>::filled() const {
-    return (write_size_ * (write_count_ + 1) + offset_) > EEPROM.length();
+template <typename S, typename Storage>
+bool StateManager<S, Storage>::filled() const {
+    return ((uint32_t)write_size_ * (write_count_ + 1) + offset_) > storage_.size();
 }
 
 }   // namespace BONK
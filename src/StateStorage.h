@@ -0,0 +1,58 @@
+// Copyright Eli Reed, 2020 released under GPLv3
+
+#ifndef STATE_STORAGE_H_
+#define STATE_STORAGE_H_
+
+#include <stdint.h>     // for uint32_t, uint16_t, uint8_t
+
+#include <EEPROM.h>     // for access to Arduino EEPROM
+
+namespace Bonk {
+
+// Where StateManager keeps its records. A storage policy is a class with
+//
+//   bool begin();           // get the medium ready; false if it isn't there
+//   uint32_t size() const;  // bytes StateManager may use
+//   bool read(uint32_t address, void* buf, uint16_t size);
+//   bool write(uint32_t address, const void* buf, uint16_t size);
+//
+// where read and write move a whole block and return false if any of it is
+// out of range or didn't make it. This is the Arduino's internal EEPROM; see
+// FramStorage.h and FileStorage.h for the others.
+class EepromStorage {
+  public:
+    bool begin() {
+        return true;
+    }
+
+    uint32_t size() const {
+        return EEPROM.length();
+    }
+
+    bool read(uint32_t address, void* buf, uint16_t size) {
+        if (address + size > EepromStorage::size()) {
+            return false;
+        }
+        uint8_t* out = static_cast<uint8_t*>(buf);
+        for (uint16_t i = 0; i < size; i++) {
+            out[i] = EEPROM.read(address + i);
+        }
+        return true;
+    }
+
+    // each byte takes 3.3ms, so only the ones that changed are written
+    bool write(uint32_t address, const void* buf, uint16_t size) {
+        if (address + size > EepromStorage::size()) {
+            return false;
+        }
+        const uint8_t* in = static_cast<const uint8_t*>(buf);
+        for (uint16_t i = 0; i < size; i++) {
+            EEPROM.update(address + i, in[i]);
+        }
+        return true;
+    }
+};  // EepromStorage class
+
+}   // namespace BONK
+
+#endif  // STATE_STORAGE_H_
@@ -0,0 +1,299 @@
+#ifndef BONK_TELEMETRY_CODEC_H
+#define BONK_TELEMETRY_CODEC_H
+
+#include <stdint.h>
+
+#include "ShipReading.h"
+
+namespace Bonk {
+
+	// Compressed ShipReadings, for recording a whole flight to SD.
+	//
+	// The stream is a series of blocks, each of which can be decoded on its
+	// own:
+	//
+	//   magic      0xB0 0x4E
+	//   records    the first one a keyframe, then up to blockRecords - 1
+	//              deltas
+	//   end        3 bytes 0xFF 0xFF 0xFF
+	//   crc        CRC-16/CCITT of everything from the magic to the end
+	//              marker, little endian
+	//
+	// Each record is a 3-byte little-endian change mask, bit 0 for the event
+	// and bit i + 1 for ReadingField i, then the event character if it
+	// changed, then a zigzag varint of each changed field's difference from
+	// the previous record, as 32-bit values. A keyframe is just a record
+	// relative to an all-zero reading. On the pad almost nothing but elapsed
+	// changes, so a reading is about 5 bytes instead of READING_RECORD_SIZE.
+
+	const uint8_t TELEMETRY_MAGIC[2] = { 0xB0, 0x4E };
+	const uint8_t TELEMETRY_MASK_BYTES = (NUM_FIELDS + 7) / 8;
+	static_assert(TELEMETRY_MASK_BYTES == 3, "the end marker assumes 3 mask bytes");
+	// bits of the mask that aren't fields; all set marks the end of a block.
+	const uint32_t TELEMETRY_END_MARKER = 0xFFFFFF;
+	const uint32_t TELEMETRY_FIELD_BITS = ((uint32_t)1 << NUM_FIELDS) - 1;
+	// deltas are 32 bits, so a wider field would be silently truncated
+#define BONK_READING_FIELD(member, Name, type, decimals) \
+	static_assert(sizeof(type) <= 4, #member " doesn't fit in a 32-bit delta");
+#include "ShipReadingFields.h"
+#undef BONK_READING_FIELD
+
+	// the most encode() can write for one reading: magic, mask, event, five
+	// bytes per field, end marker and crc.
+	const uint8_t TELEMETRY_MAX_ENCODED = 2 + TELEMETRY_MASK_BYTES + 1 + 5 * NUM_READING_FIELDS + TELEMETRY_MASK_BYTES + 2;
+
+	inline uint16_t crc16Update(uint16_t crc, uint8_t byte) {
+		crc ^= (uint16_t)byte << 8;
+		for (uint8_t i = 0; i < 8; i++) {
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+		}
+		return crc;
+	}
+
+	inline uint32_t zigzagEncode(int32_t value) {
+		return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+	}
+
+	inline int32_t zigzagDecode(uint32_t value) {
+		return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+	}
+
+	class TelemetryEncoder {
+	public:
+		// blockRecords: readings per block, ie how often there's a keyframe
+		// and how much is lost to one bad spot on the card.
+		TelemetryEncoder(uint8_t blockRecords = 100):
+			_blockRecords(blockRecords),
+			_count(0) { }
+
+		// Encodes reading into out, which must have room for
+		// TELEMETRY_MAX_ENCODED bytes, and returns how many bytes it wrote.
+		// Closes the block once it's full.
+		uint8_t encode(const ShipReading& reading, uint8_t *out) {
+			uint8_t n = 0;
+			if (_count == 0) {
+				_previous = ShipReading();
+				_previous.event = FlightEvent::NoneReached;
+				_crc = 0xFFFF;
+				n += put(out + n, TELEMETRY_MAGIC[0]);
+				n += put(out + n, TELEMETRY_MAGIC[1]);
+			}
+
+			uint32_t mask = 0;
+			if (reading.event != _previous.event) {
+				mask |= 1;
+			}
+			for (uint8_t i = 0; i < NUM_READING_FIELDS; i++) {
+				if (field(reading, i) != field(_previous, i)) {
+					mask |= (uint32_t)1 << (i + 1);
+				}
+			}
+			n += putMask(out + n, mask);
+			if (mask & 1) {
+				n += put(out + n, flightEventChar(reading.event));
+			}
+			for (uint8_t i = 0; i < NUM_READING_FIELDS; i++) {
+				if (mask & ((uint32_t)1 << (i + 1))) {
+					uint32_t delta = (uint32_t)field(reading, i) - (uint32_t)field(_previous, i);
+					n += putVarint(out + n, zigzagEncode((int32_t)delta));
+				}
+			}
+			_previous = reading;
+
+			if (++_count == _blockRecords) {
+				n += finish(out + n);
+			}
+			return n;
+		}
+
+		// true if the next encode() starts a new block
+		bool atBlockStart() const {
+			return _count == 0;
+		}
+
+		// Closes the current block early, eg before powering off. Returns the
+		// bytes written to out, which is 0 if there's no open block.
+		uint8_t finish(uint8_t *out) {
+			if (_count == 0) {
+				return 0;
+			}
+			uint8_t n = putMask(out, TELEMETRY_END_MARKER);
+			uint16_t crc = _crc;
+			out[n++] = crc & 0xFF;
+			out[n++] = crc >> 8;
+			_count = 0;
+			return n;
+		}
+	private:
+		ShipReading _previous;
+		uint16_t _crc;
+		uint8_t _blockRecords;
+		uint8_t _count; // records in the open block
+
+		static int32_t field(const ShipReading& reading, uint8_t i) {
+			return readingField(reading, (ReadingField)i);
+		}
+
+		uint8_t put(uint8_t *out, uint8_t byte) {
+			*out = byte;
+			_crc = crc16Update(_crc, byte);
+			return 1;
+		}
+
+		uint8_t putMask(uint8_t *out, uint32_t mask) {
+			for (uint8_t i = 0; i < TELEMETRY_MASK_BYTES; i++) {
+				put(out + i, mask >> (8 * i));
+			}
+			return TELEMETRY_MASK_BYTES;
+		}
+
+		uint8_t putVarint(uint8_t *out, uint32_t value) {
+			uint8_t n = 0;
+			while (value >= 0x80) {
+				n += put(out + n, (value & 0x7F) | 0x80);
+				value >>= 7;
+			}
+			return n + put(out + n, value);
+		}
+	};
+
+	// Decodes the stream a byte at a time, so it works on a byte stream off
+	// the card as well as on a file in memory on the host.
+	//
+	// Readings come out as soon as they're decoded, before the block's CRC
+	// has been checked; hold on to them until BLOCK_OK if that matters. After
+	// a bad block, it skips ahead to the next magic.
+	class TelemetryDecoder {
+	public:
+		enum class Result : uint8_t {
+			NONE,      // need more bytes
+			READING,   // reading() is the next reading
+			BLOCK_OK,  // end of a block, CRC good
+			BLOCK_BAD, // CRC mismatch or garbage; the block's readings are suspect
+		};
+
+		TelemetryDecoder(): _state(State::MAGIC0) { }
+
+		Result push(uint8_t byte) {
+			if (_state != State::CRC0 && _state != State::CRC1) {
+				_crc = crc16Update(_crc, byte);
+			}
+			switch (_state) {
+			case State::MAGIC0:
+				if (byte == TELEMETRY_MAGIC[0]) {
+					_crc = crc16Update(0xFFFF, byte);
+					_state = State::MAGIC1;
+				}
+				return Result::NONE;
+			case State::MAGIC1:
+				if (byte == TELEMETRY_MAGIC[1]) {
+					_reading = ShipReading();
+					_reading.event = FlightEvent::NoneReached;
+					startMask();
+				} else {
+					_state = byte == TELEMETRY_MAGIC[0] ? State::MAGIC1 : State::MAGIC0;
+					_crc = crc16Update(0xFFFF, byte);
+				}
+				return Result::NONE;
+			case State::MASK:
+				_mask |= (uint32_t)byte << (8 * _maskBytes);
+				if (++_maskBytes < TELEMETRY_MASK_BYTES) {
+					return Result::NONE;
+				}
+				if (_mask == TELEMETRY_END_MARKER) {
+					_state = State::CRC0;
+					return Result::NONE;
+				}
+				if (_mask & ~TELEMETRY_FIELD_BITS) {
+					_state = State::MAGIC0;
+					return Result::BLOCK_BAD;
+				}
+				if (_mask & 1) {
+					_state = State::EVENT;
+					return Result::NONE;
+				}
+				return nextField();
+			case State::EVENT: {
+				FlightEvent event;
+				if (!flightEventFromChar(byte, event)) {
+					_state = State::MAGIC0;
+					return Result::BLOCK_BAD;
+				}
+				_reading.event = event;
+				return nextField();
+			}
+			case State::VARINT:
+				if (_shift > 28) {
+					_state = State::MAGIC0;
+					return Result::BLOCK_BAD;
+				}
+				_varint |= (uint32_t)(byte & 0x7F) << _shift;
+				_shift += 7;
+				if (byte & 0x80) {
+					return Result::NONE;
+				}
+				setReadingField(_reading, (ReadingField)_field,
+				                (int32_t)((uint32_t)readingField(_reading, (ReadingField)_field)
+				                          + (uint32_t)zigzagDecode(_varint)));
+				_field++;
+				return nextField();
+			case State::CRC0:
+				_crcLow = byte;
+				_state = State::CRC1;
+				return Result::NONE;
+			case State::CRC1:
+				_state = State::MAGIC0;
+				return (_crcLow | (uint16_t)byte << 8) == _crc ? Result::BLOCK_OK : Result::BLOCK_BAD;
+			}
+			return Result::NONE;
+		}
+
+		const ShipReading& reading() const {
+			return _reading;
+		}
+	private:
+		enum class State : uint8_t {
+			MAGIC0,
+			MAGIC1,
+			MASK,
+			EVENT,
+			VARINT,
+			CRC0,
+			CRC1,
+		};
+
+		ShipReading _reading;
+		uint32_t _mask;
+		uint32_t _varint;
+		uint16_t _crc;
+		State _state;
+		uint8_t _maskBytes;
+		uint8_t _field; // next ReadingField to look at
+		uint8_t _shift;
+		uint8_t _crcLow;
+
+		void startMask() {
+			_state = State::MASK;
+			_mask = 0;
+			_maskBytes = 0;
+			_field = 0;
+		}
+
+		// move on to the next changed field, or finish the record
+		Result nextField() {
+			while (_field < NUM_READING_FIELDS && !(_mask & ((uint32_t)1 << (_field + 1)))) {
+				_field++;
+			}
+			if (_field < NUM_READING_FIELDS) {
+				_state = State::VARINT;
+				_varint = 0;
+				_shift = 0;
+				return Result::NONE;
+			}
+			startMask();
+			return Result::READING;
+		}
+	};
+}
+
+#endif // BONK_TELEMETRY_CODEC_H
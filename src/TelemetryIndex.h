@@ -0,0 +1,183 @@
+#ifndef BONK_TELEMETRY_INDEX_H
+#define BONK_TELEMETRY_INDEX_H
+
+#include <stdint.h>
+
+#include "ShipReading.h"
+#include "TelemetryCodec.h"
+
+namespace Bonk {
+
+	// Where to start decoding a telemetry file to get to a time or an event:
+	// the offset of the block that contains it.
+	struct TelemetryIndexEntry {
+		uint32_t elapsed; // ShipReading::elapsed
+		uint32_t offset;  // of the block's magic in the file
+		char event;       // flightEventChar
+		uint8_t kind;
+	};
+
+	// Entry kinds. Events are kept no matter what; periodic entries get
+	// thinned out as the index fills up.
+	const uint8_t TELEMETRY_INDEX_PERIODIC = 0;
+	const uint8_t TELEMETRY_INDEX_EVENT = 1;
+
+	// An index block, written when the file is closed:
+	//
+	//   "BIDX", entry count (2 bytes), entries (10 bytes each: elapsed,
+	//   offset, event, kind, little endian), CRC-16/CCITT of all that
+	//
+	// then a footer that's always the last 8 bytes of the file:
+	//
+	//   offset of the index block (4 bytes), "BEND"
+	//
+	// so a reader can find the latest index from the end of the file. If the
+	// file was never closed there's no footer, but each block starts with a
+	// keyframe, so a reader can still bisect on block magics.
+	const char TELEMETRY_INDEX_MAGIC[4] = { 'B', 'I', 'D', 'X' };
+	const char TELEMETRY_FOOTER_MAGIC[4] = { 'B', 'E', 'N', 'D' };
+	const uint8_t TELEMETRY_INDEX_ENTRY_SIZE = 10;
+	const uint8_t TELEMETRY_FOOTER_SIZE = 8;
+
+	inline void encodeIndexEntry(const TelemetryIndexEntry& entry, uint8_t *out) {
+		for (uint8_t i = 0; i < 4; i++) {
+			out[i] = entry.elapsed >> (8 * i);
+			out[4 + i] = entry.offset >> (8 * i);
+		}
+		out[8] = entry.event;
+		out[9] = entry.kind;
+	}
+
+	inline TelemetryIndexEntry decodeIndexEntry(const uint8_t *in) {
+		TelemetryIndexEntry entry = { 0, 0, (char)in[8], in[9] };
+		for (uint8_t i = 0; i < 4; i++) {
+			entry.elapsed |= (uint32_t)in[i] << (8 * i);
+			entry.offset |= (uint32_t)in[4 + i] << (8 * i);
+		}
+		return entry;
+	}
+
+	// Index of the blocks TelemetryLog writes, kept in RAM until close.
+	// Holds MaxEntries; when that's full, every other periodic entry goes
+	// and only every other block gets indexed from then on, so the index
+	// covers the whole flight at whatever density fits.
+	template <uint8_t MaxEntries = 24>
+	class TelemetryIndex {
+	public:
+		TelemetryIndex(): _count(0), _stride(1), _blocks(0), _event(FlightEvent::NoneReached) { }
+
+		// a block starting at offset, whose first reading is reading
+		void blockStarted(uint32_t offset, const ShipReading& reading) {
+			_blockOffset = offset;
+			if (_blocks++ % _stride == 0) {
+				add(reading, TELEMETRY_INDEX_PERIODIC);
+			}
+		}
+
+		// every reading, so event changes get indexed
+		void logged(const ShipReading& reading) {
+			if (reading.event != _event) {
+				_event = reading.event;
+				add(reading, TELEMETRY_INDEX_EVENT);
+			}
+		}
+
+		// writes the index block and footer to file (a FatFile, or anything
+		// with write(buf, size)), which is at offset. Returns the bytes
+		// written.
+		template <typename File>
+		uint32_t write(File& file, uint32_t offset) {
+			uint8_t buf[TELEMETRY_INDEX_ENTRY_SIZE];
+			uint16_t crc = 0xFFFF;
+			for (uint8_t i = 0; i < 4; i++) {
+				buf[i] = TELEMETRY_INDEX_MAGIC[i];
+			}
+			buf[4] = _count;
+			buf[5] = 0;
+			crc = writeCrc(file, buf, 6, crc);
+			for (uint8_t i = 0; i < _count; i++) {
+				encodeIndexEntry(_entries[i], buf);
+				crc = writeCrc(file, buf, TELEMETRY_INDEX_ENTRY_SIZE, crc);
+			}
+			buf[0] = crc;
+			buf[1] = crc >> 8;
+			for (uint8_t i = 0; i < 4; i++) {
+				buf[2 + i] = offset >> (8 * i);
+				buf[6 + i] = TELEMETRY_FOOTER_MAGIC[i];
+			}
+			file.write(buf, 2 + TELEMETRY_FOOTER_SIZE);
+			return 6 + (uint32_t)_count * TELEMETRY_INDEX_ENTRY_SIZE + 2 + TELEMETRY_FOOTER_SIZE;
+		}
+
+		uint8_t count() const {
+			return _count;
+		}
+		const TelemetryIndexEntry& entry(uint8_t i) const {
+			return _entries[i];
+		}
+	private:
+		TelemetryIndexEntry _entries[MaxEntries];
+		uint32_t _blockOffset; // of the block being written
+		uint8_t _count;
+		uint32_t _stride; // index every _stride-th block
+		uint32_t _blocks;
+		FlightEvent _event;
+
+		void add(const ShipReading& reading, uint8_t kind) {
+			if (_count == MaxEntries) {
+				thin();
+			}
+			if (_count == MaxEntries) { // all events!
+				return;
+			}
+			_entries[_count++] = { (uint32_t)reading.elapsed, _blockOffset, flightEventChar(reading.event), kind };
+		}
+
+		// drop every other periodic entry. If there weren't any to drop (the
+		// index is all events), the stride stays as it is.
+		void thin() {
+			uint8_t kept = 0;
+			bool keep = false;
+			for (uint8_t i = 0; i < _count; i++) {
+				if (_entries[i].kind == TELEMETRY_INDEX_PERIODIC) {
+					keep = !keep;
+					if (!keep) {
+						continue;
+					}
+				}
+				_entries[kept++] = _entries[i];
+			}
+			if (kept == _count) {
+				return;
+			}
+			_count = kept;
+			if (_stride < 0x80000000UL) {
+				_stride *= 2;
+			}
+		}
+
+		template <typename File>
+		static uint16_t writeCrc(File& file, const uint8_t *buf, uint8_t size, uint16_t crc) {
+			for (uint8_t i = 0; i < size; i++) {
+				crc = crc16Update(crc, buf[i]);
+			}
+			file.write(buf, size);
+			return crc;
+		}
+	};
+
+	// The entry to start decoding from to get to elapsed: the last one at
+	// or before it. entries must be in file order. Returns -1 if elapsed is
+	// before everything.
+	inline int findIndexEntry(const TelemetryIndexEntry *entries, int count, uint32_t elapsed) {
+		int found = -1;
+		for (int i = 0; i < count; i++) {
+			if (entries[i].elapsed <= elapsed) {
+				found = i;
+			}
+		}
+		return found;
+	}
+}
+
+#endif // BONK_TELEMETRY_INDEX_H
@@ -0,0 +1,79 @@
+#ifndef BONK_TELEMETRY_LOG_H
+#define BONK_TELEMETRY_LOG_H
+
+#include <stdint.h>
+#include <SdFat.h>
+
+#include "Profiler.h"
+#include "ShipReading.h"
+#include "TelemetryCodec.h"
+#include "TelemetryIndex.h"
+
+namespace Bonk {
+
+	// Records compressed readings to a file on the SD card, with an index so
+	// that a time or event can be found on the recovered card without
+	// decoding the whole flight. The index lives in RAM until close().
+	template <uint8_t MaxIndexEntries = 24>
+	class BasicTelemetryLog {
+	public:
+		BasicTelemetryLog(uint8_t blockRecords = 100): _encoder(blockRecords), _bytes(0) { }
+
+		bool begin(const char *path) {
+			if (!_file.open(path, O_WRITE | O_APPEND | O_CREAT)) {
+				return false;
+			}
+			_startOffset = _file.fileSize();
+			return true;
+		}
+
+		void log(const ShipReading& reading) {
+			BONK_PROFILE(LogWrite);
+			if (_encoder.atBlockStart()) {
+				_index.blockStarted(_startOffset + _bytes, reading);
+			}
+			_index.logged(reading);
+			uint8_t buf[TELEMETRY_MAX_ENCODED];
+			uint8_t n = _encoder.encode(reading, buf);
+			_file.write(buf, n);
+			_bytes += n;
+		}
+
+		// close the current block, so everything so far can be decoded
+		void finish() {
+			uint8_t buf[TELEMETRY_MASK_BYTES + 2];
+			uint8_t n = _encoder.finish(buf);
+			_file.write(buf, n);
+			_file.sync();
+			_bytes += n;
+		}
+
+		// finish(), then write the index. Call it at MissionEnd, say. Logging
+		// can carry on afterwards; closing again writes a fresh index that
+		// covers everything.
+		void close() {
+			finish();
+			_bytes += _index.write(_file, _startOffset + _bytes);
+			_file.sync();
+		}
+
+		// bytes written since boot
+		uint32_t bytes() const {
+			return _bytes;
+		}
+
+		const TelemetryIndex<MaxIndexEntries>& index() const {
+			return _index;
+		}
+	private:
+		TelemetryEncoder _encoder;
+		TelemetryIndex<MaxIndexEntries> _index;
+		FatFile _file;
+		uint32_t _startOffset; // size of the file when we opened it
+		uint32_t _bytes;
+	};
+
+	typedef BasicTelemetryLog<> TelemetryLog;
+}
+
+#endif // BONK_TELEMETRY_LOG_H
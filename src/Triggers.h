@@ -0,0 +1,131 @@
+#ifndef BONK_TRIGGERS_H
+#define BONK_TRIGGERS_H
+
+#include <stdint.h>
+
+#include "ShipReading.h"
+
+namespace Bonk {
+
+	enum class TriggerComparison : uint8_t {
+		ABOVE,
+		BELOW,
+	};
+
+	// One experiment-specific trigger: fires once when field goes past
+	// threshold and stays there for holdMillis of the ship's elapsed time,
+	// and can't fire again until the field has come back by hysteresis.
+	// Thresholds are in ShipReading units, int32_t like the fields, so mind
+	// the micrometers. For example:
+	//
+	//   // free fall: aTotal < 0.1g for 2s
+	//   { ReadingField::ATotal, TriggerComparison::BELOW, 980665, 100000, 2000 },
+	//   // launchImminent rising edge
+	//   { ReadingField::LaunchImminent, TriggerComparison::ABOVE, 0, 0, 0 },
+	struct TriggerRule {
+		ReadingField field;
+		TriggerComparison comparison;
+		int32_t threshold;
+		int32_t hysteresis;
+		uint16_t holdMillis;
+	};
+
+	// Evaluates a table of TriggerRules against each reading EventHandler
+	// accepts, and has it call onTrigger(i) for each rule i that fires. Use
+	// Triggers<N>, which brings the per-rule state, and pass it to
+	// EventHandler::setTriggers().
+	class TriggerEngine {
+	public:
+		// Returns a bit for each rule that fired on this reading. Only rules
+		// whose field changed since the last reading, or that are waiting out
+		// their hold time, get compared.
+		uint32_t evaluate(const ShipReading& reading) {
+			uint32_t fired = 0;
+			for (uint8_t i = 0; i < _numRules; i++) {
+				const TriggerRule& rule = _rules[i];
+				RuleState& state = _states[i];
+				int32_t value = readingField(reading, rule.field);
+				if (value == state.lastValue && state.phase != Phase::HOLDING && state.primed) {
+					continue;
+				}
+				state.lastValue = value;
+				state.primed = true;
+
+				bool past = rule.comparison == TriggerComparison::ABOVE
+					? value > rule.threshold
+					: value < rule.threshold;
+				switch (state.phase) {
+				case Phase::IDLE:
+					if (!past) {
+						break;
+					}
+					state.phase = Phase::HOLDING;
+					state.holdStart = reading.elapsed;
+					// fall through, in case there's no hold time
+				case Phase::HOLDING:
+					if (!past) {
+						state.phase = Phase::IDLE;
+					} else if (reading.elapsed - state.holdStart >= rule.holdMillis) {
+						state.phase = Phase::ACTIVE;
+						fired |= (uint32_t)1 << i;
+					}
+					break;
+				case Phase::ACTIVE:
+					if (rule.comparison == TriggerComparison::ABOVE
+					    ? value <= rule.threshold - rule.hysteresis
+					    : value >= rule.threshold + rule.hysteresis) {
+						state.phase = Phase::IDLE;
+					}
+					break;
+				}
+			}
+			return fired;
+		}
+
+		// true from when rule i fires until it's reset by hysteresis
+		bool active(uint8_t i) const {
+			return _states[i].phase == Phase::ACTIVE;
+		}
+
+		uint8_t numRules() const {
+			return _numRules;
+		}
+	protected:
+		enum class Phase : uint8_t {
+			IDLE,
+			HOLDING, // past the threshold, but not for long enough yet
+			ACTIVE,
+		};
+
+		struct RuleState {
+			int32_t lastValue;
+			int32_t holdStart; // ShipReading::elapsed
+			Phase phase;
+			bool primed; // seen at least one reading
+		};
+
+		TriggerEngine(const TriggerRule *rules, RuleState *states, uint8_t numRules):
+			_rules(rules), _states(states), _numRules(numRules) {
+			for (uint8_t i = 0; i < numRules; i++) {
+				_states[i] = { 0, 0, Phase::IDLE, false };
+			}
+		}
+	private:
+		const TriggerRule *_rules;
+		RuleState *_states;
+		uint8_t _numRules;
+	};
+
+	template <uint8_t N>
+	class Triggers: public TriggerEngine {
+	public:
+		static_assert(N <= 32, "at most 32 triggers");
+
+		// rules must outlive this; a static const table is the idea.
+		Triggers(const TriggerRule (&rules)[N]): TriggerEngine(rules, _ruleStates, N) { }
+	private:
+		RuleState _ruleStates[N];
+	};
+}
+
+#endif // BONK_TRIGGERS_H
@@ -0,0 +1,120 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+// Prints how much I2C traffic each high-level driver operation costs, measured
+// on the mock bus. Run it before and after touching a driver; a new row that
+// got more expensive means a new round-trip on somebody's critical path.
+
+#include <stdio.h>
+#include <string>
+
+#include "otherMocks.h"
+#include "I2cDevices.h"
+
+#include <HardwareControl.h>
+#include <PowerMonitor.h>
+
+#define TMP411_ADDRESS 0b1001101
+#define ALERT_PIN 7
+#define PCA_INT_PIN 8
+
+FakePca9557 pcaChip;
+FakeTmp411 tmpChip;
+FakeIna226 mainChip;
+
+void report(const char *operation, void (*run)()) {
+	Wire.FAKE_resetStats();
+	run();
+	const FakeI2cStats& stats = Wire.FAKE_stats();
+	printf("%-42s %6lu %6lu %10lu %10lu\n",
+	       operation,
+	       stats.transactions,
+	       stats.bytes,
+	       stats.micros(100000),
+	       stats.micros(400000));
+}
+
+Bonk::Pca9557 pins(BONK_CONTAINMENT9557_ADDRESS);
+Bonk::Pca9557 watchedPins(BONK_CONTAINMENT9557_ADDRESS);
+Bonk::Tmp411 thermometer(TMP411_ADDRESS);
+Bonk::Tmp411 cachedThermometer(TMP411_ADDRESS, true);
+Bonk::Main226 main226;
+Bonk::MainPowerMonitor monitor(ALERT_PIN);
+
+int main() {
+	Wire.FAKE_attach(BONK_CONTAINMENT9557_ADDRESS, &pcaChip);
+	pcaChip.FAKE_connectInterrupt(PCA_INT_PIN);
+	Wire.FAKE_attach(TMP411_ADDRESS, &tmpChip);
+	Wire.FAKE_attach(BONK_MAIN226_ADDRESS, &mainChip);
+
+	printf("%-42s %6s %6s %10s %10s\n", "operation", "trans", "bytes", "us@100kHz", "us@400kHz");
+
+	report("Pca9557::begin", [] { pins.begin(); });
+	report("Pca9557::pinMode x8", [] {
+		for (int i = 0; i < 8; i++) pins.pinMode(i, true);
+	});
+	report("Pca9557::digitalWrite x8", [] {
+		for (int i = 0; i < 8; i++) pins.digitalWrite(i, true);
+	});
+	report("Pca9557::writePort", [] { pins.writePort(0xFF, 0); });
+	report("Pca9557 staged pinMode+digitalWrite x8", [] {
+		pins.stage();
+		for (int i = 0; i < 8; i++) {
+			pins.pinMode(i, i < 4);
+			pins.digitalWrite(i, true);
+		}
+		pins.commit();
+	});
+	report("Pca9557::digitalRead x8", [] {
+		for (int i = 0; i < 8; i++) pins.digitalRead(i);
+	});
+	report("Pca9557::readPorts", [] {
+		uint8_t input, output;
+		pins.readPorts(input, output);
+	});
+	report("Pca9557::pollInputs", [] { pins.pollInputs(); });
+	watchedPins.begin();
+	watchedPins.watchChangeLine(PCA_INT_PIN);
+	watchedPins.pollInputs();
+	report("Pca9557::pollInputs x8, change line quiet", [] {
+		for (int i = 0; i < 8; i++) watchedPins.pollInputs();
+	});
+
+	report("Tmp411::begin", [] { thermometer.begin(); });
+	report("Tmp411 local+remote", [] {
+		thermometer.readLocalTemperature();
+		thermometer.readRemoteTemperature();
+	});
+	tmpChip.FAKE_conversionMillis = 40;
+	cachedThermometer.begin();
+	cachedThermometer.update();
+	report("Tmp411 cached, finding a conversion's end", [] {
+		// called every 5ms until one finishes
+		while (!cachedThermometer.update()) {
+			FAKE_millis += 5;
+		}
+	});
+	report("Tmp411 cached local+remote, same conversion", [] {
+		cachedThermometer.readLocalTemperature();
+		cachedThermometer.readRemoteTemperature();
+	});
+	report("Tmp411 cached local+remote, next conversion", [] {
+		FAKE_millis += 125;
+		cachedThermometer.readLocalTemperature();
+		cachedThermometer.readRemoteTemperature();
+	});
+
+	report("Main226::begin", [] { main226.begin(); });
+	report("Main226 voltage+current+power", [] {
+		main226.readBusVoltage();
+		main226.readShuntCurrent();
+		main226.readBusPower();
+	});
+	report("MainPowerMonitor::begin", [] { monitor.begin(); });
+	report("MainPowerMonitor::sample", [] { monitor.sample(); });
+	report("MainPowerMonitor::overLimit, no alert", [] {
+		FAKE_pinLevels[ALERT_PIN] = HIGH;
+		monitor.overLimit();
+	});
+	return 0;
+}
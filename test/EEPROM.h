@@ -32,6 +32,12 @@
 
 uint8_t eeprom_store[E2END + 1]; // the actual EEPROM data
 
+// from otherMocks.h
+void FAKE_advanceMicros(unsigned long us);
+// fake time each byte write takes. The real thing is 3.3ms; 0 by default so
+// tests that don't care about timing don't have to.
+unsigned long FAKE_eepromWriteMicros = 0;
+
 /***
     EERef class.
     
@@ -51,7 +57,7 @@ struct EERef{
     
     //Assignment/write members.
     EERef &operator=( const EERef &ref ) { return *this = *ref; }
-    EERef &operator=( uint8_t in )       { return eeprom_store[index] = in, *this;  }
+    EERef &operator=( uint8_t in )       { return FAKE_advanceMicros(FAKE_eepromWriteMicros), eeprom_store[index] = in, *this;  }
     EERef &operator +=( uint8_t in )     { return *this = **this + in; }
     EERef &operator -=( uint8_t in )     { return *this = **this - in; }
     EERef &operator *=( uint8_t in )     { return *this = **this * in; }
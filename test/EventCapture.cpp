@@ -0,0 +1,138 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+#include "catch.hpp"
+
+#include "otherMocks.h"
+#include "Serial.h"
+
+#include <EventCapture.h>
+
+int32_t fakeCurrent;
+int32_t readCurrent() {
+	return fakeCurrent;
+}
+int32_t readMillis() {
+	return millis();
+}
+
+const std::string& captureFile() {
+	return FAKE_sdFiles["/capture.csv"];
+}
+
+TEST_CASE("Writes samples from before and after the event") {
+	FAKE_millis = 0;
+	FAKE_sdFiles.clear();
+	Bonk::EventHandler events;
+	Bonk::Runtime<> runtime(events);
+	Bonk::EventCapture<2, 8, 3> capture;
+	REQUIRE(capture.addChannel(readCurrent));
+	REQUIRE(capture.addChannel(readMillis));
+	capture.arm(Bonk::FlightEvent::Liftoff);
+	REQUIRE(capture.begin("/capture.csv"));
+	runtime.addTask(capture, 1, 10);
+	runtime.begin();
+
+	// more samples than fit in the ring, then liftoff
+	for (int i = 0; i < 20; i++) {
+		fakeCurrent = i;
+		runtime.tick();
+		FAKE_millis += 10;
+	}
+	capture.trigger(Bonk::FlightEvent::Liftoff);
+	for (int i = 20; i < 30; i++) {
+		fakeCurrent = i;
+		runtime.tick();
+		FAKE_millis += 10;
+	}
+
+	REQUIRE(captureFile() ==
+		"capture Liftoff 200\n"
+		"-50,15,150\n"
+		"-40,16,160\n"
+		"-30,17,170\n"
+		"-20,18,180\n"
+		"-10,19,190\n"
+		"0,20,200\n"
+		"10,21,210\n"
+		"20,22,220\n");
+}
+
+TEST_CASE("Only captures armed events, once each") {
+	FAKE_millis = 0;
+	FAKE_sdFiles.clear();
+	Bonk::EventCapture<1, 4, 1> capture;
+	capture.addChannel(readMillis);
+	capture.arm(Bonk::FlightEvent::Touchdown);
+	capture.begin("/capture.csv");
+
+	capture.trigger(Bonk::FlightEvent::Apogee);
+	capture.runChunk();
+	REQUIRE(captureFile().empty());
+
+	capture.trigger(Bonk::FlightEvent::Touchdown);
+	// the one sample after, then write both
+	REQUIRE(capture.runChunk());
+	while (capture.runChunk()) { }
+	REQUIRE(captureFile() == "capture Touchdown 0\n0,0\n0,0\n");
+
+	// every reading fires the handler again, but it's the same touchdown
+	capture.trigger(Bonk::FlightEvent::Touchdown);
+	capture.runChunk();
+	REQUIRE(captureFile() == "capture Touchdown 0\n0,0\n0,0\n");
+	REQUIRE(capture.missed() == 0);
+}
+
+TEST_CASE("With no samples after the event, freezes at the trigger") {
+	FAKE_millis = 0;
+	FAKE_sdFiles.clear();
+	Bonk::EventCapture<1, 4, 0> capture;
+	capture.addChannel(readMillis);
+	capture.arm(Bonk::FlightEvent::Apogee);
+	capture.begin("/capture.csv");
+
+	for (int i = 0; i < 3; i++) {
+		capture.runChunk();
+		FAKE_millis += 10;
+	}
+	capture.trigger(Bonk::FlightEvent::Apogee);
+	REQUIRE(capture.runChunk());
+	while (capture.runChunk()) { }
+	REQUIRE(captureFile() == "capture Apogee 30\n-30,0\n-20,10\n-10,20\n");
+}
+
+TEST_CASE("Triggered before the first sample, writes just the header") {
+	FAKE_millis = 0;
+	FAKE_sdFiles.clear();
+	Bonk::EventCapture<1, 4, 0> capture;
+	capture.addChannel(readMillis);
+	capture.arm(Bonk::FlightEvent::Liftoff);
+	capture.arm(Bonk::FlightEvent::Apogee);
+	capture.begin("/capture.csv");
+
+	capture.trigger(Bonk::FlightEvent::Liftoff);
+	REQUIRE(!capture.runChunk());
+	REQUIRE(captureFile() == "capture Liftoff 0\n");
+
+	// and it's sampling again
+	for (int i = 0; i < 2; i++) {
+		FAKE_millis += 10;
+		capture.runChunk();
+	}
+	capture.trigger(Bonk::FlightEvent::Apogee);
+	while (capture.runChunk()) { }
+	REQUIRE(captureFile() == "capture Liftoff 0\ncapture Apogee 20\n-10,10\n0,20\n");
+}
+
+TEST_CASE("Counts events it was too busy to capture") {
+	FAKE_millis = 0;
+	Bonk::EventCapture<1, 4, 2> capture;
+	capture.addChannel(readMillis);
+	capture.arm(Bonk::FlightEvent::Liftoff);
+	capture.arm(Bonk::FlightEvent::MainEngineCutOff);
+	capture.begin("/capture.csv");
+	capture.trigger(Bonk::FlightEvent::Liftoff);
+	capture.runChunk();
+	capture.trigger(Bonk::FlightEvent::MainEngineCutOff);
+	REQUIRE(capture.missed() == 1);
+}
@@ -56,5 +56,81 @@ TEST_CASE("Corrupted: Invalid event") {
 TEST_CASE("Correct values for data") {
 	Bonk::ShipReading sh = give_buffer("A,2,1,1,1.234567,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1");
 	REQUIRE(sh.event == Bonk::FlightEvent::EscapeEnabled);
-	REQUIRE(sh.vx == 1234567L);
+	REQUIRE(sh.vx == 1234L);
+}
+
+class CountingEventHandler: public Bonk::EventHandler {
+public:
+	mutable int coasts = 0;
+	mutable int apogees = 0;
+protected:
+	void onCoastStart() const override {
+		coasts++;
+	}
+	void onApogee() const override {
+		apogees++;
+	}
+};
+
+TEST_CASE("Accepts every packet at 10Hz") {
+	FAKE_millis = 0;
+	CountingEventHandler ceh;
+	ceh.begin();
+	for (int i = 0; i < 5; i++) {
+		Serial.FAKE_replaceBuffer(i < 3 ? "F,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1"
+		                                : "G,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1");
+		// a packet every 100ms, with the loop ticking every 10ms
+		for (int j = 0; j < 10; j++) {
+			ceh.tick();
+			FAKE_millis += 10;
+		}
+	}
+	ceh.tick();
+	REQUIRE(ceh.coasts == 3);
+	REQUIRE(ceh.apogees == 2);
+}
+
+TEST_CASE("Parses fixed point to each field's decimals") {
+	Bonk::ShipReading sh = give_buffer("C,1234.5,1.5,-0.25,1.1234567,-3,1,1,1,1,1,1,1,1,1,1,1,1,0,1,0");
+	REQUIRE(sh.event == Bonk::FlightEvent::Liftoff);
+	REQUIRE(sh.elapsed == 1234);
+	REQUIRE(sh.altitude == 1500L);
+	REQUIRE(sh.gpsAltitude == -250L);
+	// past the last decimal we keep
+	REQUIRE(sh.vx == 1123L);
+	REQUIRE(sh.vy == -3000L);
+	REQUIRE(sh.launchImminent);
+	REQUIRE(!sh.drogueChuteImminent);
+	REQUIRE(sh.landingImminent);
+}
+
+TEST_CASE("Parses the ends of each field's range") {
+	Bonk::ShipReading sh = give_buffer("C,1,100000.5,-2147483.648,3000,1,1,1,2147.483647,-2147.483648,1,1,1,1,1,1,1,1,0,1,0");
+	REQUIRE(sh.event == Bonk::FlightEvent::Liftoff);
+	REQUIRE(sh.altitude == 100000500L);
+	REQUIRE(sh.gpsAltitude == -2147483647L - 1);
+	REQUIRE(sh.vx == 3000000L);
+	REQUIRE(sh.ax == 2147483647L);
+	REQUIRE(sh.ay == -2147483647L - 1);
+}
+
+TEST_CASE("Corrupted: a number too big for its field") {
+	// 2148m/s^2 is past what micrometers fit in
+	Bonk::ShipReading sh = give_buffer("C,1,1,1,1,1,1,1,2148,1,1,1,1,1,1,1,1,1,0,1,0");
+	REQUIRE(sh.event == Bonk::FlightEvent::NoneReached);
+	sh = give_buffer("C,1,1,1,1,1,1,1,2147.483648,1,1,1,1,1,1,1,1,1,0,1,0");
+	REQUIRE(sh.event == Bonk::FlightEvent::NoneReached);
+	// and too many digits for even a uint32_t
+	sh = give_buffer("C,99999999999,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,0,1,0");
+	REQUIRE(sh.event == Bonk::FlightEvent::NoneReached);
+}
+
+TEST_CASE("Corrupted: junk in a number") {
+	Bonk::ShipReading sh = give_buffer("C,1,1x,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1");
+	REQUIRE(sh.event == Bonk::FlightEvent::NoneReached);
+}
+
+TEST_CASE("Corrupted: bool that isn't 0 or 1") {
+	Bonk::ShipReading sh = give_buffer("C,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,2,1,1,1");
+	REQUIRE(sh.event == Bonk::FlightEvent::NoneReached);
 }
@@ -0,0 +1,142 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+#define BONK_RX_INTERRUPT
+
+#include "catch.hpp"
+
+#include "otherMocks.h"
+#include "Serial.h"
+
+#include <EventHandler.h>
+
+class CountingEventHandler: public Bonk::EventHandler {
+public:
+	mutable int coasts = 0;
+	mutable int apogees = 0;
+	// getLastReading().elapsed, from inside the handlers
+	mutable long lastElapsed = -1;
+protected:
+	void onCoastStart() const override {
+		coasts++;
+		lastElapsed = getLastReading().elapsed;
+	}
+	void onApogee() const override {
+		apogees++;
+		lastElapsed = getLastReading().elapsed;
+	}
+};
+
+CountingEventHandler *handler;
+
+void receiveByte(char incoming) {
+	handler->receive(incoming);
+}
+
+// a fresh handler, with the receive interrupt hooked up and the clock at 0
+void setUp(CountingEventHandler& ceh) {
+	FAKE_millis = 0;
+	FAKE_subMillisMicros = 0;
+	Serial.FAKE_clear();
+	Serial.FAKE_setRxCapacity(64);
+	handler = &ceh;
+	Serial.FAKE_attachRxInterrupt(receiveByte);
+	ceh.begin();
+}
+
+// schedules a packet on the wire at 115200 baud, starting at atMicros.
+// Returns when its last byte arrives.
+unsigned long send(unsigned long atMicros, const char *packet) {
+	for (size_t i = 0; packet[i] != '\0'; i++) {
+		atMicros += 87;
+		Serial.FAKE_schedule(atMicros, packet + i, 1);
+	}
+	return atMicros;
+}
+
+TEST_CASE("Parses in the receive interrupt, without the receive buffer") {
+	CountingEventHandler ceh;
+	setUp(ceh);
+	send(0, "F,1234,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1");
+	// a long way past a 64 byte buffer's worth, without ticking
+	FAKE_advanceMicros(50000);
+	REQUIRE(Serial.FAKE_overflowBytes() == 0);
+	REQUIRE(ceh.coasts == 0);
+	// the line's been quiet, so tick() finishes it and runs the handler
+	ceh.tick();
+	REQUIRE(ceh.coasts == 1);
+	REQUIRE(ceh.lastElapsed == 1234);
+	REQUIRE(ceh.getLastReading().event == Bonk::FlightEvent::CoastStart);
+	REQUIRE(ceh.lastReadingIntact());
+	Serial.FAKE_attachRxInterrupt(nullptr);
+}
+
+TEST_CASE("Publishes a reading when the next one starts") {
+	CountingEventHandler ceh;
+	setUp(ceh);
+	unsigned long end = send(0, "F,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1");
+	send(end + 5000, "G,2,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1");
+	// just into the second packet: the first is published by the interrupt,
+	// not by tick()'s quiet check, and the second isn't finished yet.
+	FAKE_advanceMicros(end + 5000 + 87 * 5);
+	ceh.tick();
+	REQUIRE(ceh.coasts == 1);
+	REQUIRE(ceh.apogees == 0);
+	REQUIRE(ceh.getLastReading().elapsed == 1);
+	Serial.FAKE_attachRxInterrupt(nullptr);
+}
+
+TEST_CASE("Counts readings replaced before tick() got to them") {
+	CountingEventHandler ceh;
+	setUp(ceh);
+	unsigned long at = 0;
+	for (int i = 0; i < 3; i++) {
+		at = send(at + 5000, i < 2 ? "F,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1"
+		                            : "G,3,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1");
+	}
+	FAKE_advanceMicros(at + 5000);
+	ceh.tick();
+	// only the latest gets its handler run
+	REQUIRE(ceh.coasts == 0);
+	REQUIRE(ceh.apogees == 1);
+	REQUIRE(ceh.lastElapsed == 3);
+	REQUIRE(ceh.supersededReadings() == 2);
+	Serial.FAKE_attachRxInterrupt(nullptr);
+}
+
+TEST_CASE("Tells when the last reading may have been overwritten") {
+	CountingEventHandler ceh;
+	setUp(ceh);
+	unsigned long at = send(0, "F,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1");
+	FAKE_advanceMicros(at + 5000);
+	ceh.tick();
+	const Bonk::ShipReading& reading = ceh.getLastReading();
+	REQUIRE(reading.elapsed == 1);
+
+	// no tick() from here on, like a slow loop()
+	unsigned long second = send(at + 10000, "G,2,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1");
+	unsigned long third = send(second + 5000, "G,3,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1");
+	send(third + 5000, "G,4,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1");
+	// the second reading goes into the other buffer when the third starts
+	FAKE_advanceMicros(second + 5000 + 87 - micros());
+	REQUIRE(reading.elapsed == 1);
+	REQUIRE(ceh.lastReadingIntact());
+
+	// and the third into this one
+	FAKE_advanceMicros(third + 5000 + 87 - micros());
+	REQUIRE(!ceh.lastReadingIntact());
+	REQUIRE(reading.elapsed == 3);
+	Serial.FAKE_attachRxInterrupt(nullptr);
+}
+
+TEST_CASE("Rejects corrupted packets in the receive interrupt") {
+	CountingEventHandler ceh;
+	setUp(ceh);
+	unsigned long at = send(0, "F,1,1x,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1");
+	at = send(at + 5000, "F,1,1,1,1,1,1,1");
+	FAKE_advanceMicros(at + 5000);
+	ceh.tick();
+	REQUIRE(ceh.coasts == 0);
+	REQUIRE(ceh.getLastReading().event == Bonk::FlightEvent::NoneReached);
+	Serial.FAKE_attachRxInterrupt(nullptr);
+}
@@ -0,0 +1,446 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+// Flies a whole synthetic mission through the real EventHandler, Runtime,
+// StateManager and LogManager on the mock hardware, on a virtual clock, and
+// reports whether the payload kept up: packets dropped, how long it took from
+// the end of a packet to its event handler, and the worst loop time.
+//
+// Every packet goes out at 10Hz with some jitter, byte by byte at the serial
+// baud rate, in fragments like a USB-serial bridge delivers them. Slow SD
+// cards and slow I2C devices can be injected:
+//
+//   test/FlightReplay.out --sd-stall-every=50 --sd-stall-us=150000
+//   test/FlightReplay.out --i2c-stall-us=2000 --jitter-ms=20
+//
+// --telemetry-out=FILE saves the compressed flight recording, for
+// tools/bonk-telemetry, and --card-out=DIR everything on the card, for
+// tools/bonk-decode. --debug=1 logs a DEBUG line for every packet, on the
+// same serial port the packets come in on.
+//
+// Built with BONK_RX_INTERRUPT (test/FlightReplayIsr.out), bytes are parsed
+// in the simulated receive interrupt as they arrive instead.
+//
+// Exits non-zero if any packet was dropped.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "otherMocks.h"
+#include "Serial.h"
+#include "I2cDevices.h"
+
+#include <BonkFramework.h>
+
+#define TMP411_ADDRESS 0b1001101
+#define CONTAINMENT_INT_PIN 8
+
+struct Options {
+	unsigned long seed = 1;
+	unsigned long padSeconds = 60;
+	unsigned long jitterMs = 5;
+	unsigned long fragmentBytes = 16;
+	unsigned long baud = 115200;
+	unsigned long rxBuffer = 64;
+	// time the rest of the sketch takes each time around loop()
+	unsigned long loopMicros = 200;
+	unsigned long sdStallEvery = 0;
+	unsigned long sdStallMicros = 0;
+	unsigned long i2cStallMicros = 0;
+	unsigned long debug = 0;
+	// write the recorded telemetry file here
+	const char *telemetryOut = nullptr;
+	// and every file on the card into this directory
+	const char *cardOut = nullptr;
+};
+
+// When each event starts, in seconds since liftoff. EscapeCommanded never
+// happens on a nominal flight, but it's in here so every handler runs.
+struct Phase {
+	Bonk::FlightEvent event;
+	long startSeconds;
+};
+const Phase phases[] = {
+	{ Bonk::FlightEvent::EscapeEnabled, -30 },
+	{ Bonk::FlightEvent::EscapeCommanded, -10 },
+	{ Bonk::FlightEvent::Liftoff, 0 },
+	{ Bonk::FlightEvent::MainEngineCutOff, 140 },
+	{ Bonk::FlightEvent::SeparationCommanded, 160 },
+	{ Bonk::FlightEvent::CoastStart, 165 },
+	{ Bonk::FlightEvent::Apogee, 240 },
+	{ Bonk::FlightEvent::CoastEnd, 400 },
+	{ Bonk::FlightEvent::DrogueChutes, 420 },
+	{ Bonk::FlightEvent::MainChutes, 450 },
+	{ Bonk::FlightEvent::Touchdown, 600 },
+	{ Bonk::FlightEvent::Safing, 620 },
+	{ Bonk::FlightEvent::MissionEnd, 640 },
+};
+const long END_SECONDS = 660;
+
+Bonk::FlightEvent eventAt(long elapsedMs) {
+	Bonk::FlightEvent event = Bonk::FlightEvent::NoneReached;
+	for (const Phase& phase : phases) {
+		if (elapsedMs >= phase.startSeconds * 1000) {
+			event = phase.event;
+		}
+	}
+	return event;
+}
+
+// a rough suborbital profile: 3g boost, then ballistic, then chutes.
+void kinematics(double t, double& altitude, double& velocity, double& acceleration) {
+	const double g = 9.81, boostAccel = 3 * g, burnout = 140;
+	if (t < 0) {
+		altitude = 0, velocity = 0, acceleration = 0;
+	} else if (t < burnout) {
+		acceleration = boostAccel - g;
+		velocity = acceleration * t;
+		altitude = 0.5 * acceleration * t * t;
+	} else {
+		double v0 = (boostAccel - g) * burnout, h0 = 0.5 * (boostAccel - g) * burnout * burnout;
+		double tc = t - burnout;
+		acceleration = -g;
+		velocity = v0 - g * tc;
+		altitude = h0 + v0 * tc - 0.5 * g * tc * tc;
+		if (t > 450) { // under main chutes
+			acceleration = 0;
+			velocity = -7;
+			altitude = altitude > 0 ? 3000 - 7 * (t - 450) : 0;
+		}
+		if (altitude < 0 || t > 600) {
+			altitude = 0, velocity = 0, acceleration = 0;
+		}
+	}
+}
+
+// milliseconds from liftoff to the first packet (negative)
+long firstElapsedMs;
+
+std::string makePacket(long elapsedMs, std::mt19937& rng) {
+	std::normal_distribution<double> noise(0, 0.05);
+	double altitude, velocity, acceleration;
+	kinematics(elapsedMs / 1000.0, altitude, velocity, acceleration);
+	double fields[15] = {
+		altitude, altitude + noise(rng) * 10,
+		noise(rng), noise(rng), velocity,
+		acceleration + 9.81, noise(rng), noise(rng), acceleration,
+		noise(rng), noise(rng), noise(rng),
+		noise(rng), noise(rng), noise(rng),
+	};
+	char buf[64];
+	std::string packet(1, Bonk::flightEventChar(eventAt(elapsedMs)));
+	// the ship counts elapsed from when it starts sending, not from liftoff
+	snprintf(buf, sizeof(buf), ",%ld", elapsedMs - firstElapsedMs);
+	packet += buf;
+	for (double field : fields) {
+		snprintf(buf, sizeof(buf), ",%.6f", field);
+		packet += buf;
+	}
+	packet += elapsedMs > -5000 && elapsedMs < 0 ? ",1" : ",0";
+	packet += ",0,0,0";
+	return packet;
+}
+
+struct Stats {
+	unsigned long sent = 0;
+	unsigned long handled = 0;
+	unsigned long minLatency = (unsigned long)-1;
+	unsigned long maxLatency = 0;
+	unsigned long long totalLatency = 0;
+	unsigned long worstLoop = 0;
+};
+
+Options options;
+Stats stats;
+// when the last byte of each packet arrived, indexed by packet number
+std::vector<unsigned long> packetEndMicros;
+
+struct PayloadState {
+	Bonk::FlightEvent lastEvent;
+	uint16_t events;
+	uint32_t packets;
+};
+
+Bonk::LogManager logManager;
+Bonk::StateManager<PayloadState> stateManager;
+Bonk::Tmp411 thermometer(TMP411_ADDRESS, true);
+Bonk::Containment9557 containment;
+Bonk::MainPowerMonitor mainMonitor;
+FakeTmp411 thermometerChip;
+FakePca9557 containmentChip;
+FakeIna226 mainChip;
+
+int32_t captureCurrent() {
+	return mainMonitor.currentMicroamps();
+}
+int32_t captureTemperature() {
+	return thermometer.readRemoteTemperature();
+}
+// 100Hz around liftoff, engine cutoff and touchdown
+Bonk::EventCapture<2, 64, 32> capture;
+Bonk::TelemetryLog telemetry;
+
+// what a typical payload does: persist the flight phase and log it whenever it
+// changes.
+class ReplayHandler: public Bonk::EventHandler {
+protected:
+#define BONK_FLIGHT_EVENT(eventChar, flightEvent) \
+	void on##flightEvent() const override { handled(Bonk::FlightEvent::flightEvent, #flightEvent); }
+#include <FlightEvents.h>
+#undef BONK_FLIGHT_EVENT
+private:
+	void handled(Bonk::FlightEvent event, const char *name) const {
+		size_t packet = getLastReading().elapsed / 100;
+		unsigned long latency = micros() - packetEndMicros[packet];
+		stats.handled++;
+		stats.totalLatency += latency;
+		if (latency < stats.minLatency) {
+			stats.minLatency = latency;
+		}
+		if (latency > stats.maxLatency) {
+			stats.maxLatency = latency;
+		}
+
+		capture.trigger(event);
+		if (options.debug) {
+			char line[48];
+			snprintf(line, sizeof(line), "%s at %ld, %luus late", name, (long)getLastReading().elapsed, latency);
+			logManager.log(Bonk::LogType::DEBUG, line);
+		}
+		logManager.log_reading(getLastReading());
+		telemetry.log(getLastReading());
+		PayloadState state;
+		stateManager.get_state(state);
+		state.packets++;
+		if (state.lastEvent != event) {
+			state.lastEvent = event;
+			state.events++;
+			logManager.log(Bonk::LogType::NOTIFY, name);
+		}
+		// every packet, but it's only committed once a second or so
+		stateManager.set_state(state);
+		stateManager.flight_event(event);
+	}
+};
+
+ReplayHandler handler;
+Bonk::Runtime<> runtime(handler);
+
+#ifdef BONK_RX_INTERRUPT
+void receiveByte(char incoming) {
+	handler.receive(incoming);
+}
+#endif
+
+void pollSensors() {
+	thermometer.readLocalTemperature();
+	thermometer.readRemoteTemperature();
+	containment.pollInputs();
+	mainMonitor.sample();
+}
+Bonk::FunctionTask sensorTask(pollSensors);
+
+void logTelemetry() {
+	char line[64];
+	snprintf(line, sizeof(line), "power %ldmA", (long)mainMonitor.currentMicroamps() / 1000);
+	logManager.log(Bonk::LogType::NOTIFY, line);
+}
+Bonk::FunctionTask telemetryTask(logTelemetry);
+
+void commitState() {
+	stateManager.tick();
+}
+Bonk::FunctionTask stateTask(commitState);
+
+void parseOptions(int argc, char **argv) {
+	struct { const char *name; unsigned long *value; } flags[] = {
+		{ "--seed=", &options.seed },
+		{ "--pad-seconds=", &options.padSeconds },
+		{ "--jitter-ms=", &options.jitterMs },
+		{ "--fragment-bytes=", &options.fragmentBytes },
+		{ "--baud=", &options.baud },
+		{ "--rx-buffer=", &options.rxBuffer },
+		{ "--loop-us=", &options.loopMicros },
+		{ "--sd-stall-every=", &options.sdStallEvery },
+		{ "--sd-stall-us=", &options.sdStallMicros },
+		{ "--i2c-stall-us=", &options.i2cStallMicros },
+		{ "--debug=", &options.debug },
+	};
+	for (int i = 1; i < argc; i++) {
+		const char *telemetryOut = "--telemetry-out=", *cardOut = "--card-out=";
+		bool known = false;
+		if (strncmp(argv[i], telemetryOut, strlen(telemetryOut)) == 0) {
+			options.telemetryOut = argv[i] + strlen(telemetryOut);
+			known = true;
+		}
+		if (strncmp(argv[i], cardOut, strlen(cardOut)) == 0) {
+			options.cardOut = argv[i] + strlen(cardOut);
+			known = true;
+		}
+		for (auto& flag : flags) {
+			if (strncmp(argv[i], flag.name, strlen(flag.name)) == 0) {
+				*flag.value = strtoul(argv[i] + strlen(flag.name), nullptr, 10);
+				known = true;
+			}
+		}
+		if (!known) {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			exit(2);
+		}
+	}
+}
+
+void saveFile(const std::string& contents, const char *path) {
+	FILE *out = fopen(path, "wb");
+	if (out == nullptr || fwrite(contents.data(), 1, contents.size(), out) != contents.size()) {
+		perror(path);
+		exit(2);
+	}
+	fclose(out);
+}
+
+// queue up every packet on the fake serial port, byte by byte.
+void schedulePackets(std::mt19937& rng) {
+	std::uniform_int_distribution<long> jitter(-(long)options.jitterMs * 1000, options.jitterMs * 1000);
+	std::uniform_int_distribution<unsigned long> fragment(1, options.fragmentBytes);
+	unsigned long byteMicros = 10 * 1000000 / options.baud; // 8N1
+	firstElapsedMs = -(long)options.padSeconds * 1000;
+	unsigned long lastByteMicros = 0;
+
+	for (long elapsed = firstElapsedMs; elapsed <= END_SECONDS * 1000; elapsed += 100) {
+		std::string packet = makePacket(elapsed, rng);
+		unsigned long start = (elapsed - firstElapsedMs) * 1000 + 1000000 + jitter(rng);
+		if (start < lastByteMicros + byteMicros) {
+			start = lastByteMicros + byteMicros;
+		}
+		// a fragment shows up all at once, when its last byte has arrived.
+		size_t sent = 0;
+		while (sent < packet.size()) {
+			size_t n = fragment(rng);
+			if (n > packet.size() - sent) {
+				n = packet.size() - sent;
+			}
+			lastByteMicros = start + (sent + n) * byteMicros;
+			Serial.FAKE_schedule(lastByteMicros, packet.data() + sent, n);
+			sent += n;
+		}
+		packetEndMicros.push_back(lastByteMicros);
+		stats.sent++;
+	}
+}
+
+int main(int argc, char **argv) {
+	parseOptions(argc, argv);
+	std::mt19937 rng(options.seed);
+
+	Serial.FAKE_setRxCapacity(options.rxBuffer);
+	Serial.FAKE_setTx(64, options.baud);
+#ifdef BONK_RX_INTERRUPT
+	Serial.FAKE_attachRxInterrupt(receiveByte);
+#endif
+	Wire.FAKE_attach(TMP411_ADDRESS, &thermometerChip);
+	thermometerChip.FAKE_conversionMillis = 40;
+	Wire.FAKE_attach(BONK_CONTAINMENT9557_ADDRESS, &containmentChip);
+	containmentChip.FAKE_connectInterrupt(CONTAINMENT_INT_PIN);
+	Wire.FAKE_attach(BONK_MAIN226_ADDRESS, &mainChip);
+	Wire.FAKE_simulateTiming(400000);
+	Wire.FAKE_stallMicros = options.i2cStallMicros;
+	FAKE_sdStallEvery = options.sdStallEvery;
+	FAKE_sdStallMicros = options.sdStallMicros;
+	FAKE_eepromWriteMicros = 3300;
+	mainChip.FAKE_busVoltage = 4000;
+	mainChip.FAKE_shuntVoltage = 2000;
+
+	schedulePackets(rng);
+
+	EEPROM.zap(0);
+	logManager.begin("/log.txt", "/data.csv");
+	stateManager.coalesce(1000);
+	stateManager.commit_on(Bonk::FlightEvent::Liftoff);
+	stateManager.commit_on(Bonk::FlightEvent::Safing);
+	stateManager.begin("/state.bin", { Bonk::FlightEvent::NoneReached, 0, 0 });
+	thermometer.begin();
+	containment.begin();
+	containment.debounce(5);
+	containment.watchChangeLine(CONTAINMENT_INT_PIN);
+	mainMonitor.begin();
+	capture.addChannel(captureCurrent);
+	capture.addChannel(captureTemperature);
+	capture.arm(Bonk::FlightEvent::Liftoff);
+	capture.arm(Bonk::FlightEvent::MainEngineCutOff);
+	capture.arm(Bonk::FlightEvent::Touchdown);
+	capture.begin("/capture.csv");
+	telemetry.begin("/flight.bin");
+	runtime.addTask(capture, 3, 10);
+	runtime.addTask(sensorTask, 2, 100);
+	runtime.addTask(telemetryTask, 1, 1000);
+	runtime.addTask(stateTask, 1, 100);
+	runtime.drainDebugOutput(logManager);
+	runtime.begin();
+
+	unsigned long end = packetEndMicros.back() + 1000000;
+	while (micros() < end) {
+		unsigned long start = micros();
+		runtime.tick();
+		unsigned long loop = micros() - start;
+		if (loop > stats.worstLoop) {
+			stats.worstLoop = loop;
+		}
+		FAKE_advanceMicros(options.loopMicros);
+	}
+
+	telemetry.close();
+	if (options.telemetryOut != nullptr) {
+		saveFile(FAKE_sdFiles["/flight.bin"], options.telemetryOut);
+	}
+	if (options.cardOut != nullptr) {
+		if (mkdir(options.cardOut, 0777) != 0 && errno != EEXIST) {
+			perror(options.cardOut);
+			exit(2);
+		}
+		for (const auto& file : FAKE_sdFiles) {
+			// the card's paths all start with /
+			saveFile(file.second, (options.cardOut + file.first).c_str());
+		}
+	}
+
+	unsigned long dropped = stats.sent - stats.handled;
+	printf("flight:            %lu packets over %.1f virtual seconds\n", stats.sent, micros() / 1e6);
+	printf("dropped packets:   %lu (%lu bytes lost to serial overflow)\n",
+	       dropped, (unsigned long)Serial.FAKE_overflowBytes());
+#ifdef BONK_RX_INTERRUPT
+	printf("superseded:        %u readings replaced before their handlers ran\n",
+	       handler.supersededReadings());
+#endif
+	if (stats.handled > 0) {
+		printf("handler latency:   min %luus, mean %lluus, max %luus\n",
+		       stats.minLatency, stats.totalLatency / stats.handled, stats.maxLatency);
+	}
+	printf("worst loop:        %luus\n", stats.worstLoop);
+	printf("ingest gaps > 75ms: %u (longest %ums)\n",
+	       runtime.stats().ingestMisses, runtime.stats().maxIngestGapMillis);
+	printf("deadline misses:   capture %u, sensors %u, telemetry %u\n",
+	       runtime.taskStats(0).deadlineMisses, runtime.taskStats(1).deadlineMisses,
+	       runtime.taskStats(2).deadlineMisses);
+	printf("captures:          %lu lines written, %u events missed\n",
+	       (unsigned long)std::count(FAKE_sdFiles["/capture.csv"].begin(), FAKE_sdFiles["/capture.csv"].end(), '\n'),
+	       capture.missed());
+	printf("state:             %lu set_state calls saved an EEPROM write\n",
+	       (unsigned long)stateManager.writes_saved());
+	if (options.debug) {
+		printf("debug output:      %lu bytes sent, %lu dropped, %luus waiting for the port\n",
+		       (unsigned long)Serial.FAKE_tx.size(), (unsigned long)logManager.debug_dropped_bytes(),
+		       Serial.FAKE_txBlockedMicros());
+	}
+	printf("telemetry:         %lu bytes compressed, %lu as CSV, %lu as records\n",
+	       (unsigned long)telemetry.bytes(), (unsigned long)FAKE_sdFiles["/data.csv"].size(),
+	       stats.handled * Bonk::READING_RECORD_SIZE);
+	return dropped == 0 ? 0 : 1;
+}
@@ -0,0 +1,389 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+#include "catch.hpp"
+
+#include <vector>
+
+#include "otherMocks.h"
+#include "I2cDevices.h"
+
+#include <HardwareControl.h>
+
+#define TMP411_ADDRESS 0b1001101
+
+TwoWire Wire1;
+
+TEST_CASE("Pca9557 writes pins, and reads them back through the input register") {
+	FakePca9557 chip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(BONK_CONTAINMENT9557_ADDRESS, &chip);
+	Bonk::Pca9557 pins(BONK_CONTAINMENT9557_ADDRESS);
+	pins.begin();
+	REQUIRE(chip.FAKE_registers[2] == 0);
+
+	pins.pinMode(3, true);
+	pins.digitalWrite(3, true);
+	REQUIRE(chip.FAKE_registers[3] == 0b11110111);
+	REQUIRE(chip.FAKE_registers[1] == 0b00001000);
+	REQUIRE(pins.digitalRead(3) == 1);
+
+	chip.FAKE_inputs = 0b10000000;
+	REQUIRE(pins.digitalRead(7) == 1);
+	REQUIRE(pins.readPort() == 0b10001000);
+}
+
+TEST_CASE("Pca9557 skips writes that wouldn't change anything") {
+	FakePca9557 chip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(BONK_CONTAINMENT9557_ADDRESS, &chip);
+	Bonk::Pca9557 pins(BONK_CONTAINMENT9557_ADDRESS);
+	pins.begin();
+	pins.pinMode(0, true);
+
+	Wire.FAKE_resetStats();
+	pins.pinMode(0, true);
+	pins.digitalWrite(0, false);
+	REQUIRE(Wire.FAKE_stats().transactions == 0);
+}
+
+TEST_CASE("Pca9557 changes the whole port in one transaction") {
+	FakePca9557 chip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(BONK_CONTAINMENT9557_ADDRESS, &chip);
+	Bonk::Pca9557 pins(BONK_CONTAINMENT9557_ADDRESS);
+	pins.begin();
+
+	Wire.FAKE_resetStats();
+	pins.configurePort(0b00001111);
+	REQUIRE(Wire.FAKE_stats().transactions == 1);
+	REQUIRE(chip.FAKE_registers[3] == 0b11110000);
+
+	Wire.FAKE_resetStats();
+	pins.writePort(0b00000101, 0xFF);
+	pins.writePort(0b00000011, 0b00000010);
+	REQUIRE(Wire.FAKE_stats().transactions == 2);
+	REQUIRE(chip.FAKE_registers[1] == 0b00000110);
+}
+
+TEST_CASE("Pca9557 staged changes go out together on commit") {
+	FakePca9557 chip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(BONK_CONTAINMENT9557_ADDRESS, &chip);
+	Bonk::Pca9557 pins(BONK_CONTAINMENT9557_ADDRESS);
+	pins.begin();
+
+	Wire.FAKE_resetStats();
+	pins.stage();
+	for (int i = 0; i < 8; i++) {
+		pins.pinMode(i, true);
+		pins.digitalWrite(i, i % 2);
+	}
+	REQUIRE(Wire.FAKE_stats().transactions == 0);
+	REQUIRE(chip.FAKE_registers[3] == 0xFF);
+
+	pins.commit();
+	REQUIRE(Wire.FAKE_stats().transactions == 2);
+	REQUIRE(chip.FAKE_registers[1] == 0b10101010);
+	REQUIRE(chip.FAKE_registers[3] == 0);
+
+	// nothing left to send
+	Wire.FAKE_resetStats();
+	pins.commit();
+	REQUIRE(Wire.FAKE_stats().transactions == 0);
+}
+
+TEST_CASE("Pca9557 only sets the register pointer once for repeated reads") {
+	FakePca9557 chip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(BONK_CONTAINMENT9557_ADDRESS, &chip);
+	Bonk::Pca9557 pins(BONK_CONTAINMENT9557_ADDRESS);
+	pins.begin();
+
+	Wire.FAKE_resetStats();
+	uint8_t input, output;
+	pins.readPorts(input, output);
+	pins.digitalRead(1);
+	pins.digitalRead(2);
+	REQUIRE(Wire.FAKE_stats().transactions == 4);
+
+	// a write moves the pointer away from the input register
+	pins.configurePort(1);
+	Wire.FAKE_resetStats();
+	pins.digitalRead(1);
+	REQUIRE(Wire.FAKE_stats().transactions == 2);
+}
+
+TEST_CASE("Pca9557 polls every input in one read and flags edges") {
+	FakePca9557 chip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(BONK_CONTAINMENT9557_ADDRESS, &chip);
+	Bonk::Pca9557 pins(BONK_CONTAINMENT9557_ADDRESS);
+	pins.begin();
+	pins.configurePort(0b10000000);
+	chip.FAKE_inputs = 0b00001111;
+	REQUIRE(!pins.pollInputs());
+	REQUIRE(pins.inputs() == 0b00001111);
+
+	chip.FAKE_inputs = 0b00110101;
+	Wire.FAKE_resetStats();
+	REQUIRE(pins.pollInputs());
+	for (int i = 0; i < 8; i++) {
+		pins.input(i);
+	}
+	REQUIRE(Wire.FAKE_stats().transactions == 1);
+	REQUIRE(pins.rose() == 0b00110000);
+	REQUIRE(pins.fell() == 0b00001010);
+	REQUIRE(pins.rose(4));
+	REQUIRE(pins.fell(1));
+	REQUIRE(!pins.rose(0));
+
+	// edges last until the next poll
+	REQUIRE(!pins.pollInputs());
+	REQUIRE(pins.rose() == 0);
+	REQUIRE(pins.fell() == 0);
+
+	// no edges for outputs
+	pins.digitalWrite(7, true);
+	REQUIRE(!pins.pollInputs());
+	REQUIRE(pins.input(7));
+	REQUIRE(pins.rose() == 0);
+}
+
+TEST_CASE("Pca9557 debounces inputs") {
+	FAKE_millis = 0;
+	FakePca9557 chip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(BONK_CONTAINMENT9557_ADDRESS, &chip);
+	Bonk::Pca9557 pins(BONK_CONTAINMENT9557_ADDRESS);
+	pins.begin();
+	pins.configurePort(0);
+	pins.debounce(5);
+	pins.pollInputs();
+
+	// bounces for 4ms, then holds
+	for (int i = 0; i < 4; i++) {
+		chip.FAKE_inputs = i % 2 == 0 ? 1 : 0;
+		REQUIRE(!pins.pollInputs());
+		FAKE_millis++;
+	}
+	chip.FAKE_inputs = 1;
+	for (int i = 0; i < 5; i++) {
+		REQUIRE(!pins.pollInputs());
+		REQUIRE(pins.inputs() == 0);
+		FAKE_millis++;
+	}
+	REQUIRE(pins.pollInputs());
+	REQUIRE(pins.rose(0));
+	REQUIRE(pins.inputs() == 1);
+
+	// a glitch shorter than that never shows up
+	chip.FAKE_inputs = 0;
+	pins.pollInputs();
+	FAKE_millis += 2;
+	chip.FAKE_inputs = 1;
+	pins.pollInputs();
+	FAKE_millis += 10;
+	REQUIRE(!pins.pollInputs());
+	REQUIRE(pins.fell() == 0);
+	REQUIRE(pins.inputs() == 1);
+}
+
+TEST_CASE("Pca9557 only reads the chip when its change line says to") {
+	FAKE_millis = 0;
+	FakePca9557 chip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(BONK_CONTAINMENT9557_ADDRESS, &chip);
+	chip.FAKE_connectInterrupt(3);
+	Bonk::Pca9557 pins(BONK_CONTAINMENT9557_ADDRESS);
+	pins.begin();
+	pins.configurePort(0);
+	pins.watchChangeLine(3);
+	REQUIRE(FAKE_pinModes[3] == INPUT_PULLUP);
+	pins.debounce(2);
+	pins.pollInputs();
+
+	Wire.FAKE_resetStats();
+	for (int i = 0; i < 100; i++) {
+		REQUIRE(!pins.pollInputs());
+		FAKE_millis++;
+	}
+	REQUIRE(Wire.FAKE_stats().transactions == 0);
+
+	// the first read lets the line go, but the change still gets debounced
+	chip.FAKE_setInputs(0b100);
+	REQUIRE(!pins.pollInputs());
+	REQUIRE(FAKE_pinLevels[3] == HIGH);
+	FAKE_millis += 2;
+	REQUIRE(pins.pollInputs());
+	REQUIRE(pins.rose() == 0b100);
+
+	Wire.FAKE_resetStats();
+	REQUIRE(!pins.pollInputs());
+	REQUIRE(Wire.FAKE_stats().transactions == 0);
+}
+
+TEST_CASE("Tmp411 configures the chip and assembles temperatures high byte first") {
+	FakeTmp411 chip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(TMP411_ADDRESS, &chip);
+	Bonk::Tmp411 thermometer(TMP411_ADDRESS);
+	thermometer.begin(true,
+			  Bonk::Tmp411Resolution::RESOLUTION_11BIT,
+			  Bonk::Tmp411ConversionRate::RATE_S25);
+	REQUIRE(chip.FAKE_config == 0b10000100);
+	REQUIRE(chip.FAKE_convRate == 6);
+	REQUIRE(chip.FAKE_resolution == 2);
+
+	chip.FAKE_localTemp = 0x1980;
+	chip.FAKE_remoteTemp = 0xFE40;
+	REQUIRE(thermometer.readLocalTemperature() == 0x1980);
+	REQUIRE(thermometer.readRemoteTemperature() == 0xFE40);
+}
+
+TEST_CASE("Cached Tmp411 reads each conversion once, just after it finishes") {
+	FakeTmp411 chip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(TMP411_ADDRESS, &chip);
+	// 125ms apart, finishing at 50ms past each multiple
+	chip.FAKE_conversionMillis = 40;
+	chip.FAKE_conversionPhase = 50;
+	FAKE_millis = 1000;
+	Bonk::Tmp411 thermometer(TMP411_ADDRESS, true);
+	thermometer.begin();
+	chip.FAKE_localTemp = 0x1900;
+	chip.FAKE_remoteTemp = 0x2000;
+
+	// something to go on straight away, then the end of the next conversion
+	REQUIRE(thermometer.readLocalTemperature() == 0x1900);
+	chip.FAKE_localTemp = 0x1A00;
+	while (!thermometer.update()) {
+		FAKE_millis += 5;
+	}
+	REQUIRE(FAKE_millis == 1050);
+	REQUIRE(thermometer.readLocalTemperature() == 0x1A00);
+
+	// once it knows, it doesn't ask: called every 5ms, with the temperature
+	// changing all the time, it reads each conversion as soon as it's done
+	FakeTmp411 otherChip;
+	Wire.FAKE_attach(TMP411_ADDRESS + 1, &otherChip);
+	Bonk::Tmp411 uncached(TMP411_ADDRESS + 1);
+	Wire.FAKE_resetStats();
+	uncached.readLocalTemperature();
+	uncached.readRemoteTemperature();
+	FakeI2cStats uncachedCost = Wire.FAKE_stats();
+	Wire.FAKE_resetStats();
+	int refreshes = 0;
+	for (FAKE_millis = 1055; FAKE_millis < 1050 + 8 * 125; FAKE_millis += 5) {
+		chip.FAKE_localTemp = FAKE_millis;
+		if (thermometer.update()) {
+			refreshes++;
+			REQUIRE((FAKE_millis - 50) % 125 == 0);
+			REQUIRE(thermometer.readLocalTemperature() == FAKE_millis);
+		}
+	}
+	REQUIRE(refreshes == 7);
+	REQUIRE(Wire.FAKE_stats().transactions <= refreshes * uncachedCost.transactions);
+	REQUIRE(Wire.FAKE_stats().bytes <= refreshes * uncachedCost.bytes);
+
+	chip.FAKE_status = 0x02;
+	REQUIRE((thermometer.readStatus() & 0x7F) == 0x02);
+}
+
+TEST_CASE("Cached Tmp411 finds the end of a conversion again now and then") {
+	FakeTmp411 chip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(TMP411_ADDRESS, &chip);
+	chip.FAKE_conversionMillis = 40;
+	FAKE_millis = 0;
+	Bonk::Tmp411 thermometer(TMP411_ADDRESS, true);
+	thermometer.begin();
+	std::vector<int> refreshes;
+	for (FAKE_millis = 0; FAKE_millis < 60 * 125; FAKE_millis++) {
+		if (FAKE_millis == 10 * 125 + 10) {
+			// the chip's clock slips behind ours
+			chip.FAKE_conversionPhase = 30;
+		}
+		if (thermometer.update()) {
+			refreshes.push_back(FAKE_millis);
+		}
+	}
+	REQUIRE(refreshes[1] == 125);
+	REQUIRE(refreshes[10] == 10 * 125);
+	// back on the chip's conversions well within SYNC_REFRESHES of them
+	for (size_t i = refreshes.size() - 20; i < refreshes.size(); i++) {
+		REQUIRE(refreshes[i] % 125 == 30);
+	}
+}
+
+TEST_CASE("Cached Tmp411 still refreshes if it can't catch the chip converting") {
+	FakeTmp411 chip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(TMP411_ADDRESS, &chip);
+	FAKE_millis = 1000;
+	Bonk::Tmp411 thermometer(TMP411_ADDRESS, true);
+	thermometer.begin();
+	chip.FAKE_localTemp = 0x1900;
+	REQUIRE(thermometer.readLocalTemperature() == 0x1900);
+	chip.FAKE_localTemp = 0x1A00;
+	FAKE_millis = 1100;
+	REQUIRE(thermometer.readLocalTemperature() == 0x1900);
+	FAKE_millis = 1125;
+	REQUIRE(thermometer.readLocalTemperature() == 0x1A00);
+}
+
+TEST_CASE("Main226 and Boost226 calibrate and read through the INA226 library") {
+	FakeIna226 mainChip, boostChip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(BONK_MAIN226_ADDRESS, &mainChip);
+	Wire.FAKE_attach(BONK_BOOST226_ADDRESS, &boostChip);
+	Bonk::Main226 main226;
+	Bonk::Boost226 boost226;
+	main226.begin();
+	boost226.begin();
+	REQUIRE(mainChip.FAKE_registers[5] != 0);
+	REQUIRE(boostChip.FAKE_registers[5] != 0);
+	REQUIRE(mainChip.FAKE_registers[6] == INA226_BIT_SOL);
+
+	// 5V, 10mV across 50 milliohms is 200mA.
+	mainChip.FAKE_busVoltage = 4000;
+	mainChip.FAKE_shuntVoltage = 4000;
+	REQUIRE(main226.readBusVoltage() == Approx(5.0));
+	REQUIRE(main226.readShuntCurrent() == Approx(0.2).epsilon(0.01));
+	REQUIRE(main226.readBusPower() == Approx(1.0).epsilon(0.01));
+}
+
+TEST_CASE("Compile-time devices store nothing but register caches") {
+	typedef Bonk::Tmp411Config<
+		true,
+		Bonk::Tmp411Resolution::RESOLUTION_9BIT,
+		Bonk::Tmp411ConversionRate::RATE_1S
+	> Config;
+	typedef Bonk::BasicTmp411<Bonk::I2cDevice<TMP411_ADDRESS>, Config> StaticTmp411;
+	REQUIRE(sizeof(Bonk::Containment9557) < sizeof(Bonk::Pca9557));
+	REQUIRE(sizeof(StaticTmp411) < sizeof(Bonk::Tmp411));
+	static_assert(Config::periodMs() == 1000, "config is a constant expression");
+	static_assert(Config::configByte() == 0b10000100, "config is a constant expression");
+}
+
+TEST_CASE("Compile-time devices talk to the bus they were given") {
+	FakePca9557 chip;
+	FakeTmp411 thermometerChip;
+	Wire.FAKE_detachAll();
+	Wire1.FAKE_attach(BONK_CONTAINMENT9557_ADDRESS, &chip);
+	Wire1.FAKE_attach(TMP411_ADDRESS, &thermometerChip);
+	Bonk::BasicPca9557<Bonk::I2cDevice<BONK_CONTAINMENT9557_ADDRESS, TwoWire, Wire1> > pins;
+	Bonk::BasicTmp411<
+		Bonk::I2cDevice<TMP411_ADDRESS, TwoWire, Wire1>,
+		Bonk::Tmp411Config<>
+	> thermometer;
+
+	Wire.FAKE_resetStats();
+	pins.begin();
+	pins.configurePort(0xFF);
+	thermometer.begin();
+	REQUIRE(Wire.FAKE_stats().transactions == 0);
+	REQUIRE(chip.FAKE_registers[3] == 0);
+	REQUIRE(thermometerChip.FAKE_config == 0b10000000);
+	REQUIRE(thermometerChip.FAKE_convRate == 7);
+}
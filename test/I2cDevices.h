@@ -0,0 +1,225 @@
+// Copyright (c) 2020 Mark Polyakov, released under GPLv3
+// Register-level models of the I2C chips on the Spaceduino and containment
+// unit, to attach to the mock Wire bus.
+
+#ifndef I2C_DEVICES_H
+#define I2C_DEVICES_H
+
+#include "Wire.h"
+
+// from otherMocks.h
+extern uint8_t FAKE_pinLevels[32];
+extern int FAKE_millis;
+
+// Like the real chip, there's no auto-increment: reads keep returning
+// whichever register the last command byte selected.
+//
+// The 9557 has no interrupt output, but the PCA9554 that can stand in for it
+// does: after FAKE_connectInterrupt(pin), FAKE_setInputs() pulls that pin low
+// when the input register no longer reads what it did last time, and reading
+// the input register lets it go again.
+class FakePca9557: public FakeI2cDevice {
+public:
+	FakePca9557(): FAKE_inputs(0), _pointer(0), _interruptPin(-1), _lastRead(0) {
+		// power-on defaults from the datasheet
+		FAKE_registers[0] = 0;
+		FAKE_registers[1] = 0;
+		FAKE_registers[2] = 0b11110000;
+		FAKE_registers[3] = 0xFF;
+	}
+
+	void FAKE_receive(const uint8_t *data, size_t size) override {
+		if (size == 0) {
+			return;
+		}
+		_pointer = data[0] & 0b11;
+		for (size_t i = 1; i < size; i++) {
+			if (_pointer != 0) { // input register is read-only
+				FAKE_registers[_pointer] = data[i];
+			}
+		}
+	}
+
+	uint8_t FAKE_transmit() override {
+		if (_pointer == 0) {
+			_lastRead = inputRegister();
+			if (_interruptPin >= 0) {
+				FAKE_pinLevels[_interruptPin] = 1;
+			}
+			return _lastRead;
+		}
+		return FAKE_registers[_pointer];
+	}
+
+	void FAKE_connectInterrupt(uint8_t pin) {
+		_interruptPin = pin;
+		_lastRead = inputRegister();
+		FAKE_pinLevels[pin] = 1;
+	}
+	void FAKE_setInputs(uint8_t inputs) {
+		FAKE_inputs = inputs;
+		if (_interruptPin >= 0 && inputRegister() != _lastRead) {
+			FAKE_pinLevels[_interruptPin] = 0;
+		}
+	}
+
+	// levels the outside world is driving onto the pins configured as inputs.
+	uint8_t FAKE_inputs;
+	// input, output, polarity inversion, config
+	uint8_t FAKE_registers[4];
+private:
+	uint8_t _pointer;
+	int _interruptPin;
+	uint8_t _lastRead;
+
+	// outputs read back what they're driving, inputs read the outside world.
+	uint8_t inputRegister() const {
+		uint8_t levels = (FAKE_registers[1] & ~FAKE_registers[3]) | (FAKE_inputs & FAKE_registers[3]);
+		return levels ^ FAKE_registers[2];
+	}
+};
+
+// Reading two bytes from one of the temperature registers returns the high
+// byte followed by the matching low byte, which is what Bonk::Tmp411 expects.
+// With FAKE_conversionMillis set, the chip converts the way the real one
+// does: one conversion a period (from the conversion rate register), each
+// FAKE_conversionMillis long and finishing FAKE_conversionPhase past a
+// multiple of the period. STATUS reads busy during one, and the result
+// registers are double-buffered: they only take up FAKE_localTemp and
+// FAKE_remoteTemp once a conversion has finished. Otherwise the results are
+// live and STATUS is whatever FAKE_status says.
+class FakeTmp411: public FakeI2cDevice {
+public:
+	FakeTmp411(): FAKE_localTemp(0), FAKE_remoteTemp(0), FAKE_status(0),
+		      FAKE_config(0), FAKE_convRate(0), FAKE_resolution(0),
+		      FAKE_conversionMillis(0), FAKE_conversionPhase(0),
+		      _pointer(0), _readN(0), _lastConversion(-1),
+		      _localResult(0), _remoteResult(0) { }
+
+	void FAKE_receive(const uint8_t *data, size_t size) override {
+		if (size == 0) {
+			return;
+		}
+		_pointer = data[0];
+		if (size < 2) {
+			return;
+		}
+		switch (_pointer) {
+		case 0x09: FAKE_config = data[1]; break;
+		case 0x0A: FAKE_convRate = data[1]; break;
+		case 0x1A: FAKE_resolution = data[1]; break;
+		}
+	}
+
+	void FAKE_startRead() override {
+		_readN = 0;
+	}
+
+	uint8_t FAKE_transmit() override {
+		bool low = _readN++ % 2 == 1;
+		uint16_t local = FAKE_localTemp, remote = FAKE_remoteTemp;
+		uint8_t status = FAKE_status;
+		if (FAKE_conversionMillis != 0) {
+			long period = 16000 >> FAKE_convRate;
+			long since = (long)FAKE_millis - FAKE_conversionPhase;
+			long conversion = since >= 0 ? since / period : (since + 1) / period - 1;
+			if (conversion != _lastConversion) {
+				_lastConversion = conversion;
+				_localResult = FAKE_localTemp;
+				_remoteResult = FAKE_remoteTemp;
+			}
+			local = _localResult;
+			remote = _remoteResult;
+			if (since - conversion * period >= period - (long)FAKE_conversionMillis) {
+				status |= 1 << 7;
+			}
+		}
+		switch (_pointer) {
+		case 0x00: return low ? local & 0xFF : local >> 8;
+		case 0x01: return low ? remote & 0xFF : remote >> 8;
+		case 0x02: return status;
+		case 0x15: return local & 0xFF;
+		case 0x10: return remote & 0xFF;
+		default: return 0;
+		}
+	}
+
+	uint16_t FAKE_localTemp;
+	uint16_t FAKE_remoteTemp;
+	uint8_t FAKE_status;
+	uint8_t FAKE_config;
+	uint8_t FAKE_convRate;
+	uint8_t FAKE_resolution;
+	unsigned long FAKE_conversionMillis;
+	unsigned long FAKE_conversionPhase;
+private:
+	uint8_t _pointer;
+	uint8_t _readN;
+	long _lastConversion; // the last one whose results were taken up
+	uint16_t _localResult;
+	uint16_t _remoteResult;
+};
+
+// Computes current and power from the shunt and bus voltages the way the chip
+// does, using whatever calibration was written to it.
+class FakeIna226: public FakeI2cDevice {
+public:
+	FakeIna226(): FAKE_shuntVoltage(0), FAKE_busVoltage(0), _pointer(0), _readN(0) {
+		for (int i = 0; i < 8; i++) {
+			FAKE_registers[i] = 0;
+		}
+		FAKE_registers[0] = 0x4127;
+	}
+
+	void FAKE_receive(const uint8_t *data, size_t size) override {
+		if (size == 0) {
+			return;
+		}
+		_pointer = data[0] & 0b111;
+		// the result registers (1 through 4) are read-only
+		if (size >= 3 && (_pointer == 0 || _pointer >= 5)) {
+			FAKE_registers[_pointer] = (data[1] << 8) | data[2];
+		}
+	}
+
+	void FAKE_startRead() override {
+		_readN = 0;
+	}
+
+	uint8_t FAKE_transmit() override {
+		uint16_t value = _read();
+		return _readN++ % 2 == 0 ? value >> 8 : value & 0xFF;
+	}
+
+	// raw ADC results: 2.5uV and 1.25mV per LSB, respectively.
+	int16_t FAKE_shuntVoltage;
+	uint16_t FAKE_busVoltage;
+	uint16_t FAKE_registers[8];
+private:
+	uint8_t _pointer;
+	uint8_t _readN;
+
+	int16_t _current() const {
+		return (int32_t)FAKE_shuntVoltage * FAKE_registers[5] / 2048;
+	}
+
+	uint16_t _read() {
+		switch (_pointer) {
+		case 1: return FAKE_shuntVoltage;
+		case 2: return FAKE_busVoltage;
+		case 3: return (uint32_t)(_current() < 0 ? -_current() : _current()) * FAKE_busVoltage / 20000;
+		case 4: return _current();
+		case 6: {
+			uint16_t maskEnable = FAKE_registers[6] | 0x0008; // conversion always ready
+			bool overLimit = (FAKE_registers[6] & 0x8000) && FAKE_shuntVoltage > (int16_t)FAKE_registers[7];
+			if (overLimit) {
+				maskEnable |= 0x0010;
+			}
+			return maskEnable;
+		}
+		default: return FAKE_registers[_pointer];
+		}
+	}
+};
+
+#endif // I2C_DEVICES_H
@@ -0,0 +1,145 @@
+// Copyright (c) 2020 Mark Polyakov, released under GPLv3
+// Mock of the Arduino-INA226 library (Korneliusz Jarzebski). Only the parts
+// the framework uses, but they do the same I2C transactions as the real thing,
+// so they show up in the bus accounting.
+
+#ifndef INA226_h
+#define INA226_h
+
+#include <inttypes.h>
+
+#include "Wire.h"
+
+#define INA226_ADDRESS              (0x40)
+
+#define INA226_REG_CONFIG           (0x00)
+#define INA226_REG_SHUNTVOLTAGE     (0x01)
+#define INA226_REG_BUSVOLTAGE       (0x02)
+#define INA226_REG_POWER            (0x03)
+#define INA226_REG_CURRENT          (0x04)
+#define INA226_REG_CALIBRATION      (0x05)
+#define INA226_REG_MASKENABLE       (0x06)
+#define INA226_REG_ALERTLIMIT       (0x07)
+
+#define INA226_BIT_SOL              (0x8000)
+#define INA226_BIT_AFF              (0x0010)
+#define INA226_BIT_CVRF             (0x0008)
+
+typedef enum {
+	INA226_AVERAGES_1    = 0b000,
+	INA226_AVERAGES_4    = 0b001,
+	INA226_AVERAGES_16   = 0b010,
+	INA226_AVERAGES_64   = 0b011,
+	INA226_AVERAGES_128  = 0b100,
+	INA226_AVERAGES_256  = 0b101,
+	INA226_AVERAGES_512  = 0b110,
+	INA226_AVERAGES_1024 = 0b111
+} ina226_averages_t;
+
+typedef enum {
+	INA226_BUS_CONV_TIME_140US  = 0b000,
+	INA226_BUS_CONV_TIME_204US  = 0b001,
+	INA226_BUS_CONV_TIME_332US  = 0b010,
+	INA226_BUS_CONV_TIME_588US  = 0b011,
+	INA226_BUS_CONV_TIME_1100US = 0b100,
+	INA226_BUS_CONV_TIME_2116US = 0b101,
+	INA226_BUS_CONV_TIME_4156US = 0b110,
+	INA226_BUS_CONV_TIME_8244US = 0b111
+} ina226_busConvTime_t;
+
+typedef enum {
+	INA226_SHUNT_CONV_TIME_140US  = 0b000,
+	INA226_SHUNT_CONV_TIME_204US  = 0b001,
+	INA226_SHUNT_CONV_TIME_332US  = 0b010,
+	INA226_SHUNT_CONV_TIME_588US  = 0b011,
+	INA226_SHUNT_CONV_TIME_1100US = 0b100,
+	INA226_SHUNT_CONV_TIME_2116US = 0b101,
+	INA226_SHUNT_CONV_TIME_4156US = 0b110,
+	INA226_SHUNT_CONV_TIME_8244US = 0b111
+} ina226_shuntConvTime_t;
+
+typedef enum {
+	INA226_MODE_POWER_DOWN      = 0b000,
+	INA226_MODE_SHUNT_TRIG      = 0b001,
+	INA226_MODE_BUS_TRIG        = 0b010,
+	INA226_MODE_SHUNT_BUS_TRIG  = 0b011,
+	INA226_MODE_ADC_OFF         = 0b100,
+	INA226_MODE_SHUNT_CONT      = 0b101,
+	INA226_MODE_BUS_CONT        = 0b110,
+	INA226_MODE_SHUNT_BUS_CONT  = 0b111,
+} ina226_mode_t;
+
+class INA226 {
+public:
+	bool begin(uint8_t address = INA226_ADDRESS) {
+		Wire.begin();
+		inaAddress = address;
+		return true;
+	}
+
+	bool configure(ina226_averages_t avg = INA226_AVERAGES_1,
+		       ina226_busConvTime_t busConvTime = INA226_BUS_CONV_TIME_1100US,
+		       ina226_shuntConvTime_t shuntConvTime = INA226_SHUNT_CONV_TIME_1100US,
+		       ina226_mode_t mode = INA226_MODE_SHUNT_BUS_CONT) {
+		uint16_t config = (avg << 9) | (busConvTime << 6) | (shuntConvTime << 3) | mode;
+		writeRegister16(INA226_REG_CONFIG, config);
+		return true;
+	}
+
+	bool calibrate(float rShuntValue = 0.1, float iMaxExpected = 2) {
+		currentLSB = iMaxExpected / 32768;
+		powerLSB = currentLSB * 25;
+		uint16_t calibrationValue = (uint16_t)(0.00512 / (currentLSB * rShuntValue));
+		writeRegister16(INA226_REG_CALIBRATION, calibrationValue);
+		return true;
+	}
+
+	float readShuntCurrent() {
+		return readRegister16(INA226_REG_CURRENT) * currentLSB;
+	}
+	float readShuntVoltage() {
+		return readRegister16(INA226_REG_SHUNTVOLTAGE) * 0.0000025;
+	}
+	float readBusPower() {
+		return (uint16_t)readRegister16(INA226_REG_POWER) * powerLSB;
+	}
+	float readBusVoltage() {
+		return (uint16_t)readRegister16(INA226_REG_BUSVOLTAGE) * 0.00125;
+	}
+
+	void enableShuntOverLimitAlert() {
+		writeRegister16(INA226_REG_MASKENABLE, INA226_BIT_SOL);
+	}
+	void setShuntVoltageLimit(float voltage) {
+		writeRegister16(INA226_REG_ALERTLIMIT, (uint16_t)(voltage * 400000));
+	}
+	bool isAlert() {
+		return (getMaskEnable() & INA226_BIT_AFF) != 0;
+	}
+	uint16_t getMaskEnable() {
+		return readRegister16(INA226_REG_MASKENABLE);
+	}
+
+private:
+	int8_t inaAddress;
+	float currentLSB, powerLSB;
+
+	void writeRegister16(uint8_t reg, uint16_t val) {
+		Wire.beginTransmission(inaAddress);
+		Wire.write(reg);
+		Wire.write((uint8_t)(val >> 8));
+		Wire.write((uint8_t)val);
+		Wire.endTransmission();
+	}
+	int16_t readRegister16(uint8_t reg) {
+		Wire.beginTransmission(inaAddress);
+		Wire.write(reg);
+		Wire.endTransmission();
+		Wire.requestFrom(inaAddress, 2);
+		uint8_t vha = Wire.read();
+		uint8_t vla = Wire.read();
+		return vha << 8 | vla;
+	}
+};
+
+#endif // INA226_h
@@ -0,0 +1,203 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+#include "catch.hpp"
+
+#include "otherMocks.h"
+#include "Serial.h"
+
+#include <LogManager.h>
+
+// 29 characters, 31 on the wire
+const char *LINE = "debug line that's 29 chars...";
+
+TEST_CASE("DEBUG output never waits for the serial port") {
+	FAKE_millis = 0;
+	FAKE_subMillisMicros = 0;
+	Serial.FAKE_setTx(64, 115200);
+	Bonk::LogManager log;
+	unsigned long blocked = Serial.FAKE_txBlockedMicros();
+
+	// 10 lines in a burst: 64 bytes go straight out, 128 more wait in the
+	// queue, and the rest don't fit.
+	for (int i = 0; i < 10; i++) {
+		log.log(Bonk::LogType::DEBUG, LINE);
+	}
+	REQUIRE(Serial.FAKE_txBlockedMicros() == blocked);
+	REQUIRE(micros() == 0);
+	REQUIRE(log.debug_dropped_bytes() > 0);
+	REQUIRE(log.debug_dropped_bytes() % 31 == 0);
+
+	// drained a little at a time as the port catches up
+	for (int i = 0; i < 100; i++) {
+		FAKE_advanceMicros(1000);
+		log.flush_debug();
+	}
+	REQUIRE(Serial.FAKE_txBlockedMicros() == blocked);
+	// only whole lines
+	std::string expected;
+	for (uint32_t sent = 0; sent < 10 * 31 - log.debug_dropped_bytes(); sent += 31) {
+		expected += LINE;
+		expected += "\r\n";
+	}
+	REQUIRE(Serial.FAKE_tx == expected);
+	Serial.FAKE_setTx(0, 115200);
+}
+
+TEST_CASE("Queued DEBUG output wraps around the ring") {
+	FAKE_millis = 0;
+	FAKE_subMillisMicros = 0;
+	Serial.FAKE_setTx(8, 115200);
+	Bonk::LogManager log;
+	std::string expected;
+	for (int i = 0; i < 20; i++) {
+		char line[16];
+		snprintf(line, sizeof(line), "line %d", i);
+		REQUIRE(log.log(Bonk::LogType::DEBUG, line) > 0);
+		expected += line;
+		expected += "\r\n";
+		FAKE_advanceMicros(500);
+		log.flush_debug();
+	}
+	for (int i = 0; i < 100; i++) {
+		FAKE_advanceMicros(1000);
+		log.flush_debug();
+	}
+	REQUIRE(log.debug_dropped_bytes() == 0);
+	REQUIRE(Serial.FAKE_tx == expected);
+	Serial.FAKE_setTx(0, 115200);
+}
+
+// what the log file has, after a reset that lost what the card hadn't synced
+std::string resetAndRecover(Bonk::BlackBox& box, const char *path) {
+	FAKE_sdFiles[path].clear();
+	Bonk::LogManager log(&box);
+	REQUIRE(log.begin(path, nullptr));
+	return FAKE_sdFiles[path];
+}
+
+TEST_CASE("ERROR and NOTIFY lines survive a reset in the black box") {
+	FAKE_millis = 0;
+	FAKE_subMillisMicros = 0;
+	Bonk::BlackBox box;
+	// power-on: RAM is junk, and none of it gets written out
+	memset(&box, 0xA5, sizeof(box));
+	REQUIRE(resetAndRecover(box, "bb.log") == "");
+
+	{
+		Bonk::LogManager log(&box);
+		log.begin("bb.log", nullptr);
+		FAKE_millis = 5;
+		log.log(Bonk::LogType::ERROR, "altimeter lost");
+		FAKE_millis = 7;
+		log.log(Bonk::LogType::WARNING, "but not this one");
+		log.log(Bonk::LogType::NOTIFY, (const uint8_t *)"armed", 5);
+	}
+	FAKE_millis = 2;
+	REQUIRE(resetAndRecover(box, "bb.log") ==
+		"[NOTIFY] 2: recovered 2 records from before reset\n"
+		"[ERR] 5: altimeter lost\n"
+		"[NOTIFY] 7: armed\n");
+	// and only once
+	REQUIRE(resetAndRecover(box, "bb.log") == "");
+
+	// synced lines are on the card already
+	{
+		Bonk::LogManager log(&box);
+		log.begin("bb.log", nullptr);
+		log.log(Bonk::LogType::ERROR, "synced");
+		log.sync();
+		log.log(Bonk::LogType::ERROR, "not synced");
+	}
+	REQUIRE(resetAndRecover(box, "bb.log") ==
+		"[NOTIFY] 2: recovered 1 records from before reset\n"
+		"[ERR] 2: not synced\n");
+}
+
+TEST_CASE("The black box keeps the newest records") {
+	FAKE_millis = 0;
+	FAKE_subMillisMicros = 0;
+	Bonk::BlackBox box;
+	memset(&box, 0, sizeof(box));
+	{
+		Bonk::LogManager log(&box);
+		log.begin("bb.log", nullptr);
+		for (int i = 0; i < 100; i++) {
+			char line[32];
+			snprintf(line, sizeof(line), "error number %d", i);
+			log.log(Bonk::LogType::ERROR, line);
+		}
+		REQUIRE(log.black_box_recovered() == 0);
+	}
+	Bonk::BlackBox saved = box;
+	std::string recovered = resetAndRecover(box, "bb.log");
+	// 23 bytes a record, and 255 usable
+	REQUIRE(recovered.find("recovered 11 records") != std::string::npos);
+	REQUIRE(recovered.find("error number 88\n") == std::string::npos);
+	REQUIRE(recovered.find("[ERR] 0: error number 89\n") != std::string::npos);
+	REQUIRE(recovered.substr(recovered.size() - 16) == "error number 99\n");
+
+	// a bad record, and everything after it, is left out
+	box = saved;
+	box.data[(box.head + sizeof(box.data) - 10) % sizeof(box.data)] ^= 1;
+	Bonk::LogManager log(&box);
+	FAKE_sdFiles["bb.log"].clear();
+	log.begin("bb.log", nullptr);
+	REQUIRE(log.black_box_recovered() == 10);
+	REQUIRE(FAKE_sdFiles["bb.log"].find("error number 99") == std::string::npos);
+}
+
+TEST_CASE("A reset between a pointer and its check keeps the black box") {
+	FAKE_millis = 0;
+	FAKE_subMillisMicros = 0;
+	Bonk::BlackBox box;
+	memset(&box, 0, sizeof(box));
+	uint16_t firstHead;
+	{
+		Bonk::LogManager log(&box);
+		log.begin("bb.log", nullptr);
+		log.log(Bonk::LogType::ERROR, "first");
+		firstHead = box.head;
+		log.log(Bonk::LogType::ERROR, "second");
+	}
+	Bonk::BlackBox saved = box;
+	const char *both =
+		"[NOTIFY] 0: recovered 2 records from before reset\n"
+		"[ERR] 0: first\n"
+		"[ERR] 0: second\n";
+
+	// head moved, head_check didn't
+	box.head_check = ~firstHead;
+	REQUIRE(resetAndRecover(box, "bb.log") == both);
+
+	// only head_check is junk
+	box = saved;
+	box.head_check = 0x1234;
+	REQUIRE(resetAndRecover(box, "bb.log") == both);
+
+	// head itself was cut off halfway, so it's junk too
+	box = saved;
+	box.head = (box.head & 0xFF00) | 0x07;
+	box.head_check = ~firstHead;
+	REQUIRE(resetAndRecover(box, "bb.log") ==
+		"[NOTIFY] 0: recovered 1 records from before reset\n"
+		"[ERR] 0: first\n");
+
+	// both junk: there's no telling where the records end
+	box = saved;
+	box.head = 3;
+	box.head_check = 0x1234;
+	REQUIRE(resetAndRecover(box, "bb.log") == "");
+
+	// tail moved past an evicted record, tail_check didn't
+	box = saved;
+	uint16_t secondTail = box.tail + box.data[box.tail] + Bonk::BLACK_BOX_RECORD_OVERHEAD;
+	box.tail_check = ~box.tail;
+	box.tail = secondTail;
+	REQUIRE(resetAndRecover(box, "bb.log") ==
+		"[NOTIFY] 0: recovered 1 records from before reset\n"
+		"[ERR] 0: second\n");
+	box = saved;
+	box.tail = 0x0101;
+	REQUIRE(resetAndRecover(box, "bb.log") == both);
+}
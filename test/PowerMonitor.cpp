@@ -0,0 +1,99 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+#include "catch.hpp"
+
+#include "otherMocks.h"
+#include "I2cDevices.h"
+
+#include <PowerMonitor.h>
+
+#define ALERT_PIN 7
+
+TEST_CASE("Scale factors match the float calibration") {
+	typedef Bonk::Ina226Scale<50, 2000> Scale;
+	// 2A / 32768 is 61.03uA, rounded up
+	REQUIRE(Scale::currentLsbMicroamps == 62);
+	REQUIRE(Scale::calibration == 1651);
+	// INA226::calibrate(0.05, 2) keeps the 61.03uA LSB, so it programs
+	// about 1677 instead. The larger LSB only rescales the register; what
+	// has to agree is calibration * LSB, which sets the current read for a
+	// given shunt voltage. Truncating 1651.6 to 1651 costs under 0.061%.
+	float floatLsb = 2.0f / 32768;
+	uint16_t floatCalibration = (uint16_t)(0.00512 / (floatLsb * 0.05));
+	REQUIRE(floatCalibration == 1677);
+	REQUIRE((float)Scale::calibration * Scale::currentLsbMicroamps ==
+		Approx(floatCalibration * floatLsb * 1e6).epsilon(0.001));
+	REQUIRE(Scale::powerLsbMicrowatts == 1550);
+	// 0.9A across 50 milliohms is 45mV, or 18000 LSBs
+	REQUIRE(Scale::shuntLimitRaw(900) == 18000);
+}
+
+TEST_CASE("Converts raw readings to integer units") {
+	FakeIna226 chip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(BONK_MAIN226_ADDRESS, &chip);
+	Bonk::MainPowerMonitor monitor;
+	monitor.begin();
+	REQUIRE(chip.FAKE_registers[5] == 1651);
+	REQUIRE(chip.FAKE_registers[7] == 18000);
+
+	// 5V, 10mV across 50 milliohms is 200mA, or 1W
+	chip.FAKE_busVoltage = 4000;
+	chip.FAKE_shuntVoltage = 4000;
+	monitor.sample();
+	REQUIRE(monitor.busMillivolts() == 5000);
+	REQUIRE(monitor.currentMicroamps() == Approx(200000).epsilon(0.001));
+	REQUIRE(monitor.powerMicrowatts() == Approx(1000000).epsilon(0.001));
+
+	chip.FAKE_shuntVoltage = -4000;
+	monitor.sample();
+	REQUIRE(monitor.currentMicroamps() == Approx(-200000).epsilon(0.001));
+	REQUIRE(monitor.powerMicrowatts() == Approx(1000000).epsilon(0.001));
+}
+
+TEST_CASE("Keeps min, max, mean and energy") {
+	FakeIna226 chip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(BONK_MAIN226_ADDRESS, &chip);
+	FAKE_millis = 0;
+	Bonk::MainPowerMonitor monitor;
+	monitor.begin();
+
+	chip.FAKE_busVoltage = 4000;
+	// 100mA and 300mA, half a second each, at 5V
+	chip.FAKE_shuntVoltage = 2000;
+	FAKE_millis += 500;
+	monitor.sample();
+	chip.FAKE_shuntVoltage = 6000;
+	FAKE_millis += 500;
+	monitor.sample();
+
+	REQUIRE(monitor.stats().samples == 2);
+	REQUIRE(monitor.stats().minCurrentMicroamps == Approx(100000).epsilon(0.001));
+	REQUIRE(monitor.stats().maxCurrentMicroamps == Approx(300000).epsilon(0.001));
+	REQUIRE(monitor.meanCurrentMicroamps() == Approx(200000).epsilon(0.001));
+	REQUIRE(monitor.stats().minBusMillivolts == 5000);
+	// 0.5W for 0.5s then 1.5W for 0.5s is 1J, or 0.2777mWh
+	REQUIRE(monitor.energyMicrowattHours() == Approx(277).margin(1));
+}
+
+TEST_CASE("Only polls the alert register once the alert pin goes low") {
+	FakeIna226 chip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(BONK_MAIN226_ADDRESS, &chip);
+	Bonk::MainPowerMonitor monitor(ALERT_PIN);
+	monitor.begin();
+	REQUIRE(FAKE_pinModes[ALERT_PIN] == INPUT_PULLUP);
+
+	FAKE_pinLevels[ALERT_PIN] = HIGH;
+	Wire.FAKE_resetStats();
+	REQUIRE(!monitor.overLimit());
+	REQUIRE(Wire.FAKE_stats().transactions == 0);
+
+	// 1A is over the 0.9A limit
+	chip.FAKE_shuntVoltage = 20000;
+	FAKE_pinLevels[ALERT_PIN] = LOW;
+	REQUIRE(monitor.overLimit());
+	REQUIRE(Wire.FAKE_stats().transactions == 2);
+}
@@ -0,0 +1,96 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+#define BONK_PROFILING
+
+#include "catch.hpp"
+
+#include "otherMocks.h"
+#include "Serial.h"
+#include "I2cDevices.h"
+
+#include <BonkFramework.h>
+
+const Bonk::ProfileEntry& entry(Bonk::ProfileProbe probe) {
+	return Bonk::profileTable()[(uint8_t)probe];
+}
+
+TEST_CASE("Probes time I2C calls on the fake clock") {
+	FakePca9557 chip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(BONK_CONTAINMENT9557_ADDRESS, &chip);
+	Wire.FAKE_simulateTiming(100000);
+	Bonk::resetProfile();
+	Bonk::Pca9557 pins(BONK_CONTAINMENT9557_ADDRESS);
+
+	pins.writePort(0xFF, 0x0F);
+	pins.readPort();
+	REQUIRE(entry(Bonk::ProfileProbe::Pca9557).calls == 2);
+	// 3 bytes written, then a pointer write and 1 byte read, at 100kHz
+	REQUIRE(entry(Bonk::ProfileProbe::Pca9557).totalMicros == 290 + 200 + 200);
+	REQUIRE(entry(Bonk::ProfileProbe::Pca9557).maxMicros == 400);
+	Wire.FAKE_simulateTiming(0);
+}
+
+TEST_CASE("Probes time Main226 and Boost226 as well as PowerMonitor") {
+	FakeIna226 mainChip, boostChip;
+	Wire.FAKE_detachAll();
+	Wire.FAKE_attach(BONK_MAIN226_ADDRESS, &mainChip);
+	Wire.FAKE_attach(BONK_BOOST226_ADDRESS, &boostChip);
+	Bonk::resetProfile();
+	Bonk::Main226 main226;
+	Bonk::Boost226 boost226;
+
+	// setup is one call however many registers it writes
+	main226.begin();
+	boost226.begin();
+	REQUIRE(entry(Bonk::ProfileProbe::Ina226).calls == 2);
+	main226.readBusVoltage();
+	main226.readShuntVoltage();
+	main226.readShuntCurrent();
+	boost226.readBusPower();
+	REQUIRE(entry(Bonk::ProfileProbe::Ina226).calls == 6);
+}
+
+TEST_CASE("Probes count parsing, dispatch and EEPROM writes") {
+	Bonk::resetProfile();
+	FAKE_millis = 0;
+	Bonk::EventHandler events;
+	events.begin();
+	Serial.FAKE_replaceBuffer("F,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1");
+	events.tick();
+	FAKE_millis = 100;
+	events.tick();
+	REQUIRE(entry(Bonk::ProfileProbe::Parse).calls == 1);
+	REQUIRE(entry(Bonk::ProfileProbe::EventDispatch).calls == 1);
+
+	Bonk::StateManager<unsigned char> sm;
+	EEPROM.zap(0);
+	sm.begin("/blap", 0);
+	sm.set_state(1);
+	REQUIRE(entry(Bonk::ProfileProbe::EepromWrite).calls == 2);
+	REQUIRE(entry(Bonk::ProfileProbe::SdFlush).calls == 0);
+}
+
+TEST_CASE("Runtime dumps the table through LogManager at MissionEnd") {
+	Bonk::resetProfile();
+	FAKE_millis = 0;
+	Bonk::LogManager log;
+	Bonk::EventHandler events;
+	Bonk::Runtime<> runtime(events);
+	runtime.logProfileAtMissionEnd(log);
+	runtime.begin();
+
+	Serial.FAKE_replaceBuffer("M,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1");
+	runtime.tick();
+	// the packet isn't over until the line goes quiet
+	REQUIRE(entry(Bonk::ProfileProbe::LogWrite).calls == 0);
+	FAKE_millis = 100;
+	runtime.tick();
+	REQUIRE(entry(Bonk::ProfileProbe::LogWrite).calls == Bonk::NUM_PROFILE_PROBES);
+
+	// only once
+	FAKE_millis = 200;
+	runtime.tick();
+	REQUIRE(entry(Bonk::ProfileProbe::LogWrite).calls == Bonk::NUM_PROFILE_PROBES);
+}
@@ -0,0 +1,136 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+#include "catch.hpp"
+
+#include "otherMocks.h"
+#include "Serial.h"
+
+#include <EventHandler.h>
+#include <LogManager.h>
+#include <Runtime.h>
+
+// pretends to work for a while, one chunk at a time, remembering the order
+// things ran in.
+class BusyTask: public Bonk::Task {
+public:
+	BusyTask(char name, int chunks, int chunkMillis, std::string& log):
+		_name(name), _chunks(chunks), _chunkMillis(chunkMillis), _left(chunks), _log(log) { }
+	bool runChunk() override {
+		_log += _name;
+		FAKE_millis += _chunkMillis;
+		if (--_left == 0) {
+			_left = _chunks;
+			return false;
+		}
+		return true;
+	}
+private:
+	char _name;
+	int _chunks;
+	int _chunkMillis;
+	int _left;
+	std::string& _log;
+};
+
+TEST_CASE("Runs due tasks in priority order") {
+	FAKE_millis = 0;
+	std::string log;
+	Bonk::EventHandler events;
+	Bonk::Runtime<> runtime(events, 50);
+	BusyTask low('l', 1, 1, log), high('h', 1, 1, log), background('b', 1, 1, log);
+	REQUIRE(runtime.addTask(low, 1, 100));
+	REQUIRE(runtime.addTask(background, 1, 0));
+	REQUIRE(runtime.addTask(high, 5, 100));
+	runtime.begin();
+
+	runtime.tick();
+	REQUIRE(log == "hlb");
+
+	// only the background task is due until the period is up
+	FAKE_millis = 50;
+	runtime.tick();
+	REQUIRE(log == "hlbb");
+	FAKE_millis = 100;
+	runtime.tick();
+	REQUIRE(log == "hlbbhlb");
+}
+
+TEST_CASE("Stops at the budget and picks up where it left off") {
+	FAKE_millis = 0;
+	std::string log;
+	Bonk::EventHandler events;
+	Bonk::Runtime<> runtime(events, 20);
+	BusyTask flush('f', 5, 10, log);
+	runtime.addTask(flush, 1, 1000);
+	runtime.begin();
+
+	runtime.tick();
+	REQUIRE(log == "ff");
+	runtime.tick();
+	REQUIRE(log == "ffff");
+	runtime.tick();
+	REQUIRE(log == "fffff");
+	REQUIRE(runtime.taskStats(0).completions == 1);
+	REQUIRE(runtime.taskStats(0).maxChunkMillis == 10);
+	REQUIRE(runtime.stats().overBudgetLoops == 0);
+	REQUIRE(runtime.stats().ingestMisses == 0);
+}
+
+TEST_CASE("Counts deadline misses and late ingestion") {
+	FAKE_millis = 0;
+	std::string log;
+	Bonk::EventHandler events;
+	Bonk::Runtime<> runtime(events, 20);
+	// a single 100ms chunk is more than EventHandler can tolerate
+	BusyTask hog('h', 1, 100, log);
+	BusyTask poll('p', 1, 1, log);
+	runtime.addTask(hog, 5, 200);
+	runtime.addTask(poll, 1, 50);
+	runtime.begin();
+
+	runtime.tick();
+	REQUIRE(log == "h");
+	REQUIRE(runtime.stats().ingestMisses == 1);
+	REQUIRE(runtime.stats().maxIngestGapMillis == 100);
+	REQUIRE(runtime.stats().overBudgetLoops == 1);
+	REQUIRE(runtime.stats().maxLoopMillis == 100);
+
+	// poll's period ran out while it was still waiting
+	runtime.tick();
+	REQUIRE(log == "hp");
+	REQUIRE(runtime.taskStats(1).deadlineMisses == 1);
+}
+
+TEST_CASE("Refuses tasks past the maximum") {
+	std::string log;
+	Bonk::EventHandler events;
+	Bonk::Runtime<1> runtime(events);
+	BusyTask a('a', 1, 1, log), b('b', 1, 1, log);
+	REQUIRE(runtime.addTask(a, 1, 10));
+	REQUIRE(!runtime.addTask(b, 1, 10));
+}
+
+TEST_CASE("Drains DEBUG output between chunks") {
+	FAKE_millis = 0;
+	FAKE_subMillisMicros = 0;
+	Serial.FAKE_setTx(64, 115200);
+	std::string log;
+	Bonk::LogManager logManager;
+	Bonk::EventHandler events;
+	Bonk::Runtime<> runtime(events, 50);
+	BusyTask slow('s', 3, 10, log);
+	REQUIRE(runtime.addTask(slow, 1, 100));
+	runtime.drainDebugOutput(logManager);
+	runtime.begin();
+
+	// more than the port's buffer
+	for (int i = 0; i < 3; i++) {
+		logManager.log(Bonk::LogType::DEBUG, "0123456789012345678901234567890123456789");
+	}
+	REQUIRE(Serial.FAKE_tx.size() == 64);
+	runtime.tick();
+	REQUIRE(Serial.FAKE_tx.size() == 3 * 42 - logManager.debug_dropped_bytes());
+	REQUIRE(Serial.FAKE_txBlockedMicros() == 0);
+	Serial.FAKE_setTx(0, 115200);
+}
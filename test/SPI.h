@@ -0,0 +1,100 @@
+// Copyright (c) 2020 Mark Polyakov, released under GPLv3
+// SPI library mock: a simulated bus with devices on chip select pins, which
+// counts every transaction and byte that goes over it.
+
+#ifndef SPI_H
+#define SPI_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+// from otherMocks.h
+void FAKE_advanceMicros(unsigned long us);
+extern uint8_t FAKE_pinLevels[32];
+
+// A model of something on the bus. See SpiDevices.h.
+class FakeSpiDevice {
+public:
+	virtual ~FakeSpiDevice() { }
+	// its chip select went low: a new command is starting.
+	virtual void FAKE_select() { }
+	// exchange a byte: the device gets in, and puts what it returns on MISO.
+	virtual uint8_t FAKE_transfer(uint8_t in) = 0;
+};
+
+class SPISettings {
+public:
+	SPISettings() { }
+	SPISettings(uint32_t, uint8_t, uint8_t) { }
+};
+
+// A transaction is everything between beginTransaction() and
+// endTransaction(). Devices only notice their chip select going low at the
+// first byte after that, so drivers have to deselect between transactions,
+// which they should anyway.
+class SPIClass {
+public:
+	SPIClass(): _transactions(0), _bytes(0), _timingClockHz(0) {
+		for (int i = 0; i < 32; i++) {
+			_devices[i] = nullptr;
+			_selected[i] = false;
+		}
+	}
+
+	void begin() { }
+	void beginTransaction(SPISettings) {
+		_transactions++;
+	}
+	void endTransaction() {
+		for (int i = 0; i < 32; i++) {
+			_selected[i] = false;
+		}
+	}
+
+	uint8_t transfer(uint8_t data) {
+		_bytes++;
+		if (_timingClockHz != 0) {
+			FAKE_advanceMicros(8 * 1000000 / _timingClockHz);
+		}
+		uint8_t in = 0xFF; // nobody driving MISO
+		for (int pin = 0; pin < 32; pin++) {
+			if (_devices[pin] == nullptr || FAKE_pinLevels[pin] != 0) {
+				continue;
+			}
+			if (!_selected[pin]) {
+				_selected[pin] = true;
+				_devices[pin]->FAKE_select();
+			}
+			in = _devices[pin]->FAKE_transfer(data);
+		}
+		return in;
+	}
+
+	void FAKE_attach(uint8_t csPin, FakeSpiDevice *device) {
+		_devices[csPin] = device;
+	}
+	unsigned long FAKE_transactions() const {
+		return _transactions;
+	}
+	unsigned long FAKE_bytes() const {
+		return _bytes;
+	}
+	// make every byte take as long as it would at clockHz on the fake clock.
+	// 0 (the default) makes the bus instantaneous again.
+	void FAKE_simulateTiming(unsigned long clockHz) {
+		_timingClockHz = clockHz;
+	}
+private:
+	FakeSpiDevice *_devices[32];
+	bool _selected[32];
+	unsigned long _transactions;
+	unsigned long _bytes;
+	unsigned long _timingClockHz;
+};
+
+SPIClass SPI;
+
+#endif // SPI_H
@@ -6,22 +6,68 @@
 
 #include <inttypes.h>
 #include <string.h>
+#include <map>
+#include <string>
 
+// the same as the host's where it has them, so host code that opens real
+// files (FileStorage.h) can be used alongside the mock
+#include <fcntl.h>
+#ifndef O_APPEND
 #define O_APPEND (1<<1)
+#endif
 #define O_WRITE  (1<<2)
+#ifndef O_CREAT
+#define O_CREAT  (1<<3)
+#endif
+
+// from otherMocks.h
+void FAKE_advanceMicros(unsigned long us);
+
+// Every FAKE_sdStallEvery-th write keeps the card busy for FAKE_sdStallMicros
+// of fake time, like a real card that stops to erase a block now and then.
+// 0 (the default) never stalls.
+unsigned long FAKE_sdStallEvery = 0;
+unsigned long FAKE_sdStallMicros = 0;
+unsigned long FAKE_sdWrites = 0;
+
+void FAKE_sdWrite() {
+	FAKE_sdWrites++;
+	if (FAKE_sdStallEvery != 0 && FAKE_sdWrites % FAKE_sdStallEvery == 0) {
+		FAKE_advanceMicros(FAKE_sdStallMicros);
+	}
+}
+
+// everything written to each file, by path
+std::map<std::string, std::string> FAKE_sdFiles;
 
 class FatFile {
 public:
-	void close() { }
-	FatFile open(const char *blah, int bleh) { return *this; } 
-	bool write(uint8_t) { return true; }
-	size_t write(const char *blah) { return strlen(blah); }
-	size_t write(const uint8_t *blah, size_t size) { return size; }
+	FatFile(): path(nullptr) { }
+	void close() { path = nullptr; }
+	bool open(const char *path_arg, int bleh) {
+		path = path_arg;
+		return true;
+	}
+	bool write(uint8_t c) { return FAKE_sdWrite(), append((const char *)&c, 1), true; }
+	size_t write(const char *blah) { FAKE_sdWrite(); return append(blah, strlen(blah)); }
+	size_t write(const uint8_t *blah, size_t size) { FAKE_sdWrite(); return append((const char *)blah, size); }
 	size_t print(const char *blah) { return strlen(blah); }
 	size_t println() { return 1; }
 	void sync() { }
+	uint32_t fileSize() const {
+		return path == nullptr ? 0 : FAKE_sdFiles[path].size();
+	}
 	
 	operator bool() const { return true; }
+private:
+	const char *path;
+
+	size_t append(const char *data, size_t size) {
+		if (path != nullptr) {
+			FAKE_sdFiles[path].append(data, size);
+		}
+		return size;
+	}
 };
 
 #endif // SD_H
@@ -4,47 +4,208 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
+#include <string>
+#include <vector>
+
+// from otherMocks.h
+extern int FAKE_millis;
+extern unsigned long FAKE_subMillisMicros;
+extern void (*FAKE_interruptSource)();
+extern unsigned long FAKE_interruptAt;
+unsigned long micros();
+void FAKE_advanceMicros(unsigned long us);
+
+void FAKE_serialInterrupts();
 
 class FakeSerial {
 public:
-	FakeSerial(): buf_sz(0), buf_n(1) { }
+	FakeSerial(): buf_n(0), rx_capacity(0), overflow_bytes(0), rx_isr(nullptr),
+	              tx_capacity(0), tx_byte_micros(0), tx_free_at(0), tx_blocked_micros(0) { }
 
-	bool available() const {
-		return buf_n < buf_sz;
+	int available() {
+		deliver_scheduled();
+		return buf.size() - buf_n;
 	}
 
 	char read() {
-		return available() ? buf[buf_n++] : -1;
+		return available() > 0 ? buf[buf_n++] : -1;
 	}
 
-	size_t write(const uint8_t *buf, size_t size) {
-		// I sure hope it's null terminated!
-		printf("%s", buf);
+	size_t write(const uint8_t *data, size_t size) {
+		for (size_t i = 0; i < size; i++) {
+			transmit(data[i]);
+		}
 		return size;
 	}
 
-	size_t write(const char *buf) {
-		printf("%s", buf);
-		return strlen(buf);
+	size_t write(const char *data) {
+		return write((const uint8_t *)data, strlen(data));
 	}
 
 	size_t println() {
-		puts("");
-		return 1;
+		return write("\r\n");
+	}
+
+	size_t println(const char *data) {
+		return write(data) + println();
+	}
+
+	// room in the transmit buffer
+	int availableForWrite() {
+		if (tx_capacity == 0) {
+			return 0x7FFF;
+		}
+		unsigned long now = micros();
+		if (tx_free_at <= now) {
+			return tx_capacity;
+		}
+		return tx_capacity - (tx_free_at - now + tx_byte_micros - 1) / tx_byte_micros;
 	}
 
 	// add data to buffer
 	void FAKE_replaceBuffer(const char *buf_arg) {
 		buf = buf_arg;
-		buf_sz = strlen(buf_arg);
 		buf_n = 0;
-	} 
+	}
+
+	// bytes arriving on the wire. Anything that doesn't fit in the receive
+	// buffer is lost, like on the real thing.
+	void FAKE_receive(const char *data, size_t size) {
+		if (buf_n > 0) {
+			buf.erase(0, buf_n);
+			buf_n = 0;
+		}
+		for (size_t i = 0; i < size; i++) {
+			if (rx_capacity != 0 && buf.size() >= rx_capacity) {
+				overflow_bytes++;
+			} else {
+				buf += data[i];
+			}
+		}
+	}
+
+	// have data arrive at a given time on the fake clock. It shows up in
+	// the receive buffer once micros() gets there. Must be scheduled in order.
+	void FAKE_schedule(unsigned long at_micros, const char *data, size_t size) {
+		for (size_t i = 0; i < size; i++) {
+			scheduled.push_back({ at_micros, data[i] });
+		}
+	}
+
+	// limit the receive buffer to this many bytes, eg 64 for the AVR core.
+	// 0, the default, is unlimited.
+	void FAKE_setRxCapacity(size_t capacity) {
+		rx_capacity = capacity;
+	}
+
+	size_t FAKE_overflowBytes() const {
+		return overflow_bytes;
+	}
+
+	// Limit the transmit buffer to capacity bytes, sent at baud, eg 64 for
+	// the AVR core. Writing to a full buffer waits on the fake clock for
+	// room, like the real thing. What's written is kept in FAKE_tx instead
+	// of printed. 0, the default, is unlimited and instant.
+	void FAKE_setTx(size_t capacity, unsigned long baud) {
+		tx_capacity = capacity;
+		tx_byte_micros = 10 * 1000000 / baud; // 8N1
+		tx_free_at = 0;
+		FAKE_tx.clear();
+	}
+
+	// fake time spent waiting for room to write
+	unsigned long FAKE_txBlockedMicros() const {
+		return tx_blocked_micros;
+	}
+
+	std::string FAKE_tx;
+
+	// Run isr in (simulated) interrupt context for each scheduled byte as it
+	// arrives, like a receive interrupt handler reading the data register,
+	// instead of putting it in the receive buffer. nullptr goes back to the
+	// buffer.
+	void FAKE_attachRxInterrupt(void (*isr)(char)) {
+		rx_isr = isr;
+		FAKE_interruptSource = isr == nullptr ? nullptr : FAKE_serialInterrupts;
+	}
+
+	// forget everything scheduled or received
+	void FAKE_clear() {
+		scheduled.clear();
+		scheduled_n = 0;
+		buf.clear();
+		buf_n = 0;
+		overflow_bytes = 0;
+	}
+
+	// called by FAKE_runInterrupts
+	void FAKE_raiseInterrupts() {
+		// not micros(), which would be the time of the interrupt
+		unsigned long now = FAKE_millis * 1000UL + FAKE_subMillisMicros;
+		while (rx_isr != nullptr && scheduled_n < scheduled.size() && scheduled[scheduled_n].at_micros <= now) {
+			FAKE_interruptAt = scheduled[scheduled_n].at_micros;
+			rx_isr(scheduled[scheduled_n++].data);
+		}
+	}
 private:
-	const char *buf;
-	size_t buf_sz;
+	struct ScheduledByte {
+		unsigned long at_micros;
+		char data;
+	};
+
+	std::vector<ScheduledByte> scheduled;
+	size_t scheduled_n = 0;
+	std::string buf;
 	size_t buf_n; // current index into buf
+	size_t rx_capacity;
+	size_t overflow_bytes;
+	void (*rx_isr)(char);
+	size_t tx_capacity;
+	unsigned long tx_byte_micros;
+	unsigned long tx_free_at; // micros() when the transmit buffer will be empty
+	unsigned long tx_blocked_micros;
+
+	void transmit(uint8_t c) {
+		if (tx_capacity == 0) {
+			putchar(c);
+			return;
+		}
+		unsigned long now = micros();
+		if (tx_free_at < now) {
+			tx_free_at = now;
+		}
+		if (tx_free_at - now >= tx_capacity * tx_byte_micros) {
+			unsigned long wait = tx_free_at - now - (tx_capacity - 1) * tx_byte_micros;
+			tx_blocked_micros += wait;
+			FAKE_advanceMicros(wait);
+		}
+		tx_free_at += tx_byte_micros;
+		FAKE_tx += (char)c;
+	}
+
+	void deliver_scheduled() {
+		if (rx_isr != nullptr) {
+			return;
+		}
+		size_t first = scheduled_n;
+		unsigned long now = micros();
+		while (scheduled_n < scheduled.size() && scheduled[scheduled_n].at_micros <= now) {
+			scheduled_n++;
+		}
+		std::string arrived;
+		for (size_t i = first; i < scheduled_n; i++) {
+			arrived += scheduled[i].data;
+		}
+		if (!arrived.empty()) {
+			FAKE_receive(arrived.data(), arrived.size());
+		}
+	}
 };
 
 FakeSerial Serial;
 
+void FAKE_serialInterrupts() {
+	Serial.FAKE_raiseInterrupts();
+}
+
 #endif
@@ -0,0 +1,79 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+#include "catch.hpp"
+
+#include "otherMocks.h"
+#include "Serial.h"
+
+#include <LogManager.h>
+#include <ShipReading.h>
+
+Bonk::ShipReading sampleReading() {
+	Bonk::ShipReading r = { 0 };
+	r.event = Bonk::FlightEvent::Apogee;
+	r.elapsed = 240000;
+	r.altitude = 1234567890;
+	r.vz = -1500;
+	r.angz = -1;
+	r.landingImminent = true;
+	return r;
+}
+
+TEST_CASE("Schema matches the wire format") {
+	REQUIRE(Bonk::NUM_FIELDS == 21);
+	REQUIRE(Bonk::NUM_READING_FIELDS == 20);
+	REQUIRE(Bonk::READING_RECORD_SIZE == 1 + 16 * 4 + 4);
+	REQUIRE(std::string(Bonk::readingFieldName(Bonk::ReadingField::GpsAltitude)) == "gpsAltitude");
+	REQUIRE(Bonk::readingField(sampleReading(), Bonk::ReadingField::Vz) == -1500);
+	REQUIRE(Bonk::readingField(sampleReading(), Bonk::ReadingField::LandingImminent) == 1);
+}
+
+TEST_CASE("Binary records round trip") {
+	uint8_t record[Bonk::READING_RECORD_SIZE];
+	Bonk::encodeReading(sampleReading(), record);
+	REQUIRE(record[0] == 'G');
+	// elapsed, little endian
+	REQUIRE(record[1] == (240000 & 0xFF));
+	REQUIRE(record[3] == (240000 >> 16));
+
+	Bonk::ShipReading decoded;
+	REQUIRE(Bonk::decodeReading(record, decoded));
+	Bonk::ShipReading original = sampleReading();
+	REQUIRE(memcmp(&decoded, &original, sizeof(decoded)) == 0);
+
+	record[0] = '*';
+	REQUIRE(!Bonk::decodeReading(record, decoded));
+}
+
+TEST_CASE("Formats CSV with the wire's decimals") {
+	REQUIRE(std::string(Bonk::READING_CSV_HEADER) ==
+		"event,elapsed,altitude,gpsAltitude,vx,vy,vz,aTotal,ax,ay,az,"
+		"phi,theta,psi,angx,angy,angz,"
+		"launchImminent,drogueChuteImminent,landingImminent,chuteFaultWarning");
+	char row[256];
+	int n = Bonk::formatReadingCsv(sampleReading(), row, sizeof(row));
+	REQUIRE(std::string(row) ==
+		"G,240000,1234567.890,0.000,0.000,0.000,-1.500,0.000000,0.000000,0.000000,0.000000,"
+		"0.000000,0.000000,0.000000,0.000000,0.000000,-0.000001,0,0,1,0");
+	REQUIRE(n == (int)strlen(row));
+
+	// truncated like snprintf
+	char small[8];
+	REQUIRE(Bonk::formatReadingCsv(sampleReading(), small, sizeof(small)) == n);
+	REQUIRE(std::string(small) == "G,24000");
+}
+
+TEST_CASE("LogManager writes readings to the data file") {
+	FAKE_sdFiles.clear();
+	Bonk::LogManager log;
+	log.begin("/log.txt", "/data.csv");
+	log.log_reading(sampleReading());
+	const std::string& data = FAKE_sdFiles["/data.csv"];
+	REQUIRE(data.find(std::string(Bonk::READING_CSV_HEADER) + "\nG,240000,1234567.890,") == 0);
+
+	// the header only goes at the top of the file
+	Bonk::LogManager again;
+	again.begin("/log.txt", "/data.csv");
+	REQUIRE(data.find("event", 1) == std::string::npos);
+}
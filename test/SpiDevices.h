@@ -0,0 +1,74 @@
+// Copyright (c) 2020 Mark Polyakov, released under GPLv3
+// Models of the SPI chips, to attach to the mock SPI bus.
+
+#ifndef SPI_DEVICES_H
+#define SPI_DEVICES_H
+
+#include <vector>
+
+#include "SPI.h"
+
+// An MB85RS/FM25V style FRAM: WREN, then WRITE or READ with a big-endian
+// address, auto-incrementing and wrapping at the end. Writes without WREN
+// first are ignored, like the real thing, and a write or WRDI clears WREN
+// again. RDSR reads the write enable latch back in bit 1.
+class FakeFram: public FakeSpiDevice {
+public:
+	FakeFram(uint32_t bytes, uint8_t addressBytes = 2):
+		FAKE_memory(bytes, 0), FAKE_writes(0), _addressBytes(addressBytes),
+		_opcode(0), _n(0), _address(0), _writeEnabled(false) { }
+
+	void FAKE_select() override {
+		if (_opcode == WRITE) {
+			_writeEnabled = false;
+		}
+		_opcode = 0;
+		_n = 0;
+		_address = 0;
+	}
+
+	uint8_t FAKE_transfer(uint8_t in) override {
+		if (_n++ == 0) {
+			_opcode = in;
+			if (_opcode == WREN) {
+				_writeEnabled = true;
+			} else if (_opcode == WRDI) {
+				_writeEnabled = false;
+			} else if (_opcode == WRITE && _writeEnabled) {
+				FAKE_writes++;
+			}
+			return 0;
+		}
+		if (_opcode == RDSR) {
+			return _writeEnabled ? 1 << 1 : 0;
+		}
+		if (_n <= 1u + _addressBytes) {
+			_address = (_address << 8 | in) % FAKE_memory.size();
+			return 0;
+		}
+		uint8_t out = FAKE_memory[_address];
+		if (_opcode == WRITE && _writeEnabled) {
+			FAKE_memory[_address] = in;
+		}
+		_address = (_address + 1) % FAKE_memory.size();
+		return _opcode == READ ? out : 0;
+	}
+
+	std::vector<uint8_t> FAKE_memory;
+	// WRITE commands that went through
+	unsigned long FAKE_writes;
+private:
+	static const uint8_t WREN = 0x06;
+	static const uint8_t WRDI = 0x04;
+	static const uint8_t RDSR = 0x05;
+	static const uint8_t WRITE = 0x02;
+	static const uint8_t READ = 0x03;
+
+	uint8_t _addressBytes;
+	uint8_t _opcode;
+	uint32_t _n;
+	uint32_t _address;
+	bool _writeEnabled;
+};
+
+#endif // SPI_DEVICES_H
@@ -3,14 +3,19 @@
 
 #include "catch.hpp"
 
+#include <unistd.h>
+
 #include "otherMocks.h"
 #include "Serial.h"
+#include "SpiDevices.h"
 
 #include <LogManager.h>
 // shhhh, nobody has to know
 #define private public
 #include <StateManager.h>
 #undef private
+#include <FileStorage.h>
+#include <FramStorage.h>
 
 TEST_CASE("Starts in default state (from zapped)") {
   Bonk::StateManager<unsigned char> sm;
@@ -74,3 +79,253 @@ TEST_CASE("Fills up") {
   REQUIRE(sm.filled());
 }
 
+
+TEST_CASE("Coalesces writes until the interval is up") {
+  FAKE_millis = 0;
+  Bonk::StateManager<unsigned char> sm;
+  EEPROM.zap(0);
+  sm.coalesce(1000);
+  REQUIRE(sm.begin("/blap", 7));
+  uint16_t writes;
+  sm.get_write_count(writes);
+  for (int i = 1; i <= 100; i++) {
+    REQUIRE(sm.set_state(i));
+    FAKE_millis += 5;
+    REQUIRE(sm.tick());
+  }
+  unsigned char state;
+  REQUIRE(sm.get_state(state));
+  REQUIRE(state == 100);
+  REQUIRE(sm.dirty());
+  uint16_t coalesced_writes;
+  sm.get_write_count(coalesced_writes);
+  REQUIRE(coalesced_writes == writes);
+  REQUIRE(sm.writes_saved() == 99);
+
+  // a reset now comes back up in the last committed state
+  Bonk::StateManager<unsigned char> after_reset;
+  REQUIRE(after_reset.begin("/blap", 0));
+  REQUIRE(after_reset.get_state(state));
+  REQUIRE(state == 7);
+
+  // set_state(7) at 30ms put it back to the committed state, so the
+  // interval starts over from set_state(8) at 35ms
+  FAKE_millis = 1034;
+  REQUIRE(sm.tick());
+  REQUIRE(sm.dirty());
+  FAKE_millis = 1035;
+  REQUIRE(sm.tick());
+  REQUIRE(!sm.dirty());
+  Bonk::StateManager<unsigned char> after_commit;
+  REQUIRE(after_commit.begin("/blap", 0));
+  REQUIRE(after_commit.get_state(state));
+  REQUIRE(state == 100);
+}
+
+TEST_CASE("Commits on request, and only if something changed") {
+  FAKE_millis = 0;
+  Bonk::StateManager<unsigned char> sm;
+  EEPROM.zap(0);
+  sm.coalesce(60000);
+  REQUIRE(sm.begin("/blap", 7));
+  uint16_t before, after;
+  sm.get_write_count(before);
+  REQUIRE(sm.set_state(7));
+  REQUIRE(!sm.dirty());
+  REQUIRE(sm.commit());
+  sm.get_write_count(after);
+  REQUIRE(after == before);
+  REQUIRE(sm.writes_saved() == 1);
+
+  REQUIRE(sm.set_state(8));
+  REQUIRE(sm.commit());
+  sm.get_write_count(after);
+  REQUIRE(after == before + 1);
+  Bonk::StateManager<unsigned char> after_reset;
+  unsigned char state;
+  REQUIRE(after_reset.begin("/blap", 0));
+  REQUIRE(after_reset.get_state(state));
+  REQUIRE(state == 8);
+}
+
+TEST_CASE("Setting a state and then setting it back leaves nothing to commit") {
+  FAKE_millis = 0;
+  Bonk::StateManager<unsigned char> sm;
+  EEPROM.zap(0);
+  sm.coalesce(60000);
+  REQUIRE(sm.begin("/blap", 7));
+  uint16_t before, after;
+  sm.get_write_count(before);
+  REQUIRE(sm.set_state(8));
+  REQUIRE(sm.dirty());
+  REQUIRE(sm.set_state(7));
+  REQUIRE(!sm.dirty());
+  REQUIRE(sm.commit());
+  FAKE_millis = 60000;
+  REQUIRE(sm.tick());
+  sm.get_write_count(after);
+  REQUIRE(after == before);
+  // neither call needed a write
+  REQUIRE(sm.writes_saved() == 2);
+
+  // and a real change after that still gets its full interval
+  FAKE_millis = 70000;
+  REQUIRE(sm.set_state(9));
+  FAKE_millis = 129999;
+  REQUIRE(sm.tick());
+  REQUIRE(sm.dirty());
+  FAKE_millis = 130000;
+  REQUIRE(sm.tick());
+  REQUIRE(!sm.dirty());
+  sm.get_write_count(after);
+  REQUIRE(after == before + 1);
+}
+
+TEST_CASE("Commits on the first reading of chosen flight events") {
+  FAKE_millis = 0;
+  Bonk::StateManager<unsigned char> sm;
+  EEPROM.zap(0);
+  sm.coalesce(60000);
+  sm.commit_on(Bonk::FlightEvent::Liftoff);
+  REQUIRE(sm.begin("/blap", 0));
+
+  sm.set_state(1);
+  REQUIRE(sm.flight_event(Bonk::FlightEvent::EscapeEnabled));
+  REQUIRE(sm.dirty());
+  REQUIRE(sm.flight_event(Bonk::FlightEvent::Liftoff));
+  REQUIRE(!sm.dirty());
+
+  // later readings of the same event don't commit again
+  sm.set_state(2);
+  REQUIRE(sm.flight_event(Bonk::FlightEvent::Liftoff));
+  REQUIRE(sm.dirty());
+}
+
+TEST_CASE("Coalescing saves EEPROM time") {
+  FAKE_millis = 0;
+  FAKE_eepromWriteMicros = 3300;
+  Bonk::StateManager<uint32_t> through, coalesced;
+  EEPROM.zap(0);
+  REQUIRE(through.begin("/blap", 0));
+  unsigned long start = micros();
+  for (uint32_t i = 1; i <= 10; i++) {
+    through.set_state(i);
+  }
+  unsigned long through_micros = micros() - start;
+
+  EEPROM.zap(0);
+  coalesced.coalesce(1000);
+  REQUIRE(coalesced.begin("/blap", 0));
+  start = micros();
+  for (uint32_t i = 1; i <= 10; i++) {
+    coalesced.set_state(i);
+  }
+  coalesced.commit();
+  unsigned long coalesced_micros = micros() - start;
+  FAKE_eepromWriteMicros = 0;
+
+  REQUIRE(coalesced_micros * 5 < through_micros);
+}
+
+struct BigState {
+  uint32_t counters[15];
+  uint8_t flags;
+};
+
+TEST_CASE("Keeps state on SPI FRAM") {
+  FAKE_millis = 0;
+  FAKE_subMillisMicros = 0;
+  FakeFram fram(8192);
+  SPI.FAKE_attach(10, &fram);
+  SPI.FAKE_simulateTiming(8000000);
+  BigState state = {};
+  {
+    Bonk::StateManager<BigState, Bonk::FramStorage> sm(Bonk::FramStorage(10, 8192));
+    REQUIRE(sm.begin("/blap", state));
+    unsigned long start = micros();
+    for (int i = 1; i <= 100; i++) {
+      state.counters[i % 15] = i;
+      REQUIRE(sm.set_state(state));
+    }
+    // 61 bytes a record, at 1us a byte and no write delay
+    REQUIRE(micros() - start < 100 * 100);
+    uint16_t writes;
+    REQUIRE(sm.get_write_count(writes));
+    REQUIRE(writes == 101);
+  }
+  REQUIRE(fram.FAKE_writes == 3 * 101);
+
+  // reset
+  Bonk::StateManager<BigState, Bonk::FramStorage> after_reset(Bonk::FramStorage(10, 8192));
+  BigState fallback = {};
+  BigState got;
+  REQUIRE(after_reset.begin("/blap", fallback));
+  REQUIRE(after_reset.get_state(got));
+  REQUIRE(memcmp(&got, &state, sizeof(state)) == 0);
+  SPI.FAKE_simulateTiming(0);
+}
+
+// pulls MISO low whatever it's sent, like a chip that's there but dead
+class SilentSpiDevice: public FakeSpiDevice {
+public:
+  uint8_t FAKE_transfer(uint8_t) override {
+    return 0;
+  }
+};
+
+TEST_CASE("Notices when the FRAM isn't there") {
+  BigState state = {};
+  // nothing on the chip select, so MISO floats high
+  {
+    Bonk::StateManager<BigState, Bonk::FramStorage> sm(Bonk::FramStorage(11, 8192));
+    REQUIRE(!sm.begin("/blap", state));
+    REQUIRE(!sm.set_state(state));
+  }
+  // or stuck low
+  SilentSpiDevice silent;
+  SPI.FAKE_attach(11, &silent);
+  {
+    Bonk::StateManager<BigState, Bonk::FramStorage> sm(Bonk::FramStorage(11, 8192));
+    REQUIRE(!sm.begin("/blap", state));
+  }
+
+  // and when it goes away after begin()
+  FakeFram fram(8192);
+  SPI.FAKE_attach(11, &fram);
+  Bonk::StateManager<BigState, Bonk::FramStorage> sm(Bonk::FramStorage(11, 8192));
+  REQUIRE(sm.begin("/blap", state));
+  state.flags = 1;
+  REQUIRE(sm.set_state(state));
+  SPI.FAKE_attach(11, nullptr);
+  state.flags = 2;
+  REQUIRE(!sm.set_state(state));
+  SPI.FAKE_attach(11, &silent);
+  REQUIRE(!sm.set_state(state));
+  SPI.FAKE_attach(11, nullptr);
+}
+
+TEST_CASE("Keeps state in a memory-mapped file") {
+  const char *path = "test/StateManager.state";
+  unlink(path);
+  {
+    Bonk::StateManager<BigState, Bonk::FileStorage> sm(Bonk::FileStorage(path, 65536));
+    BigState state = {};
+    REQUIRE(sm.begin("/blap", state));
+    for (int i = 1; i <= 1000; i++) {
+      state.counters[0] = i;
+      REQUIRE(sm.set_state(state));
+    }
+    // all of them fit without going to the SD card
+    uint16_t writes;
+    REQUIRE(sm.get_write_count(writes));
+    REQUIRE(writes == 1001);
+  }
+
+  // a different process could do this too
+  Bonk::StateManager<BigState, Bonk::FileStorage> after_reset(Bonk::FileStorage(path, 65536));
+  BigState state = {};
+  REQUIRE(after_reset.begin("/blap", state));
+  REQUIRE(after_reset.get_state(state));
+  REQUIRE(state.counters[0] == 1000);
+  unlink(path);
+}
@@ -0,0 +1,161 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+#include "catch.hpp"
+
+#include "otherMocks.h"
+#include "Serial.h"
+
+#include <vector>
+#include <TelemetryLog.h>
+
+// a reading every 100ms, climbing, with a little noise in the fast fields
+std::vector<Bonk::ShipReading> flight(int n, bool onPad) {
+	std::vector<Bonk::ShipReading> readings;
+	for (int i = 0; i < n; i++) {
+		Bonk::ShipReading r = Bonk::ShipReading();
+		r.event = onPad ? Bonk::FlightEvent::NoneReached : Bonk::FlightEvent::Liftoff;
+		r.elapsed = i * 100;
+		if (!onPad) {
+			r.altitude = i * 1000L;
+			r.vz = 10000L + (i % 7) - 3;
+			r.az = -9806650L + (i % 5) * 100;
+			r.angz = -(i % 3);
+		}
+		r.launchImminent = i > n / 2;
+		readings.push_back(r);
+	}
+	return readings;
+}
+
+std::vector<uint8_t> encodeAll(const std::vector<Bonk::ShipReading>& readings, uint8_t blockRecords) {
+	Bonk::TelemetryEncoder encoder(blockRecords);
+	std::vector<uint8_t> stream;
+	uint8_t buf[Bonk::TELEMETRY_MAX_ENCODED];
+	for (const Bonk::ShipReading& r : readings) {
+		uint8_t n = encoder.encode(r, buf);
+		REQUIRE(n <= Bonk::TELEMETRY_MAX_ENCODED);
+		stream.insert(stream.end(), buf, buf + n);
+	}
+	uint8_t n = encoder.finish(buf);
+	stream.insert(stream.end(), buf, buf + n);
+	return stream;
+}
+
+struct Decoded {
+	std::vector<Bonk::ShipReading> readings;
+	int goodBlocks = 0;
+	int badBlocks = 0;
+};
+
+Decoded decodeAll(const std::vector<uint8_t>& stream) {
+	Decoded decoded;
+	Bonk::TelemetryDecoder decoder;
+	for (uint8_t byte : stream) {
+		switch (decoder.push(byte)) {
+		case Bonk::TelemetryDecoder::Result::READING:
+			decoded.readings.push_back(decoder.reading());
+			break;
+		case Bonk::TelemetryDecoder::Result::BLOCK_OK:
+			decoded.goodBlocks++;
+			break;
+		case Bonk::TelemetryDecoder::Result::BLOCK_BAD:
+			decoded.badBlocks++;
+			break;
+		case Bonk::TelemetryDecoder::Result::NONE:
+			break;
+		}
+	}
+	return decoded;
+}
+
+bool same(const Bonk::ShipReading& a, const Bonk::ShipReading& b) {
+	return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+TEST_CASE("Zigzag maps small magnitudes to small numbers") {
+	REQUIRE(Bonk::zigzagEncode(0) == 0);
+	REQUIRE(Bonk::zigzagEncode(-1) == 1);
+	REQUIRE(Bonk::zigzagEncode(1) == 2);
+	REQUIRE(Bonk::zigzagEncode(INT32_MIN) == 0xFFFFFFFF);
+	for (int32_t v : { 0, 1, -1, 63, -64, 1000000, INT32_MAX, INT32_MIN }) {
+		REQUIRE(Bonk::zigzagDecode(Bonk::zigzagEncode(v)) == v);
+	}
+}
+
+TEST_CASE("Round trips a flight across several blocks") {
+	std::vector<Bonk::ShipReading> readings = flight(250, false);
+	// extremes, to check the 32-bit wraparound
+	readings[10].ax = INT32_MAX;
+	readings[11].ax = INT32_MIN;
+	readings[12].event = Bonk::FlightEvent::MainEngineCutOff;
+	Decoded decoded = decodeAll(encodeAll(readings, 100));
+	REQUIRE(decoded.readings.size() == readings.size());
+	for (size_t i = 0; i < readings.size(); i++) {
+		REQUIRE(same(decoded.readings[i], readings[i]));
+	}
+	REQUIRE(decoded.goodBlocks == 3);
+	REQUIRE(decoded.badBlocks == 0);
+}
+
+TEST_CASE("Round trips each field's extremes") {
+	// every field swinging between the ends of int32_t, so each delta wraps
+	std::vector<Bonk::ShipReading> readings;
+	const int32_t values[] = { INT32_MAX, INT32_MIN, 0, INT32_MIN, INT32_MAX, -1 };
+	for (int32_t value : values) {
+		Bonk::ShipReading r = Bonk::ShipReading();
+		r.event = Bonk::FlightEvent::Apogee;
+		for (uint8_t i = 0; i < Bonk::NUM_READING_FIELDS; i++) {
+			Bonk::setReadingField(r, (Bonk::ReadingField)i, value);
+		}
+		// bools are 0 or 1
+		r.launchImminent = r.drogueChuteImminent = r.landingImminent = r.chuteFaultWarning = value < 0;
+		readings.push_back(r);
+	}
+	Decoded decoded = decodeAll(encodeAll(readings, 4));
+	REQUIRE(decoded.badBlocks == 0);
+	REQUIRE(decoded.readings.size() == readings.size());
+	for (size_t i = 0; i < readings.size(); i++) {
+		REQUIRE(same(decoded.readings[i], readings[i]));
+	}
+	REQUIRE(decoded.readings[0].altitude == INT32_MAX);
+	REQUIRE(decoded.readings[1].altitude == INT32_MIN);
+}
+
+TEST_CASE("Compresses a pad wait at least 5x") {
+	std::vector<Bonk::ShipReading> readings = flight(1000, true);
+	std::vector<uint8_t> stream = encodeAll(readings, 100);
+	REQUIRE(stream.size() * 5 < readings.size() * Bonk::READING_RECORD_SIZE);
+}
+
+TEST_CASE("Catches corruption and picks up at the next block") {
+	std::vector<Bonk::ShipReading> readings = flight(300, false);
+	std::vector<uint8_t> stream = encodeAll(readings, 100);
+	// flip a bit in the middle of the first block
+	stream[50] ^= 0x04;
+	Decoded decoded = decodeAll(stream);
+	REQUIRE(decoded.badBlocks == 1);
+	REQUIRE(decoded.goodBlocks == 2);
+	// the last two blocks come through intact
+	REQUIRE(decoded.readings.size() >= 200);
+	size_t offset = decoded.readings.size() - 200;
+	for (size_t i = 0; i < 200; i++) {
+		REQUIRE(same(decoded.readings[offset + i], readings[100 + i]));
+	}
+}
+
+TEST_CASE("TelemetryLog writes decodable blocks to the card") {
+	FAKE_sdFiles.clear();
+	Bonk::TelemetryLog log(10);
+	REQUIRE(log.begin("/flight.bin"));
+	std::vector<Bonk::ShipReading> readings = flight(25, false);
+	for (const Bonk::ShipReading& r : readings) {
+		log.log(r);
+	}
+	log.finish();
+	const std::string& file = FAKE_sdFiles["/flight.bin"];
+	REQUIRE(file.size() == log.bytes());
+	Decoded decoded = decodeAll(std::vector<uint8_t>(file.begin(), file.end()));
+	REQUIRE(decoded.readings.size() == 25);
+	REQUIRE(decoded.goodBlocks == 3);
+}
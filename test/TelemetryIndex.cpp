@@ -0,0 +1,132 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+#include "catch.hpp"
+
+#include "otherMocks.h"
+#include "Serial.h"
+
+#include <vector>
+#include <TelemetryLog.h>
+
+// a reading every 100ms, with the event moving on every eventEvery readings
+Bonk::ShipReading reading(int i, int eventEvery) {
+	Bonk::ShipReading r = Bonk::ShipReading();
+	r.elapsed = i * 100;
+	r.altitude = i * 1000;
+	r.event = (Bonk::FlightEvent)(i / eventEvery);
+	return r;
+}
+
+uint32_t le32(const std::string& s, size_t at) {
+	return (uint8_t)s[at] | (uint32_t)(uint8_t)s[at + 1] << 8
+		| (uint32_t)(uint8_t)s[at + 2] << 16 | (uint32_t)(uint8_t)s[at + 3] << 24;
+}
+
+TEST_CASE("Index thins periodic entries but keeps events") {
+	Bonk::BasicTelemetryLog<8> log(10);
+	FAKE_sdFiles.erase("/idx.bin");
+	REQUIRE(log.begin("/idx.bin"));
+	// 40 blocks, with an event every 100 readings
+	for (int i = 0; i < 400; i++) {
+		log.log(reading(i, 100));
+	}
+	const Bonk::TelemetryIndex<8>& index = log.index();
+	REQUIRE(index.count() <= 8);
+	int events = 0;
+	for (uint8_t i = 0; i < index.count(); i++) {
+		if (index.entry(i).kind == Bonk::TELEMETRY_INDEX_EVENT) {
+			events++;
+		}
+		if (i > 0) {
+			REQUIRE(index.entry(i).elapsed >= index.entry(i - 1).elapsed);
+			REQUIRE(index.entry(i).offset >= index.entry(i - 1).offset);
+		}
+	}
+	// every event after NoneReached
+	REQUIRE(events == 3);
+	// periodic entries still reach the end of the flight
+	REQUIRE(index.entry(index.count() - 1).elapsed >= 20000);
+}
+
+TEST_CASE("Index keeps thinning through a long flight") {
+	Bonk::ShipReading r = reading(0, 1);
+	// only periodic entries: thinned far more than 8 times
+	Bonk::TelemetryIndex<4> periodic;
+	for (uint32_t block = 0; block < 200000; block++) {
+		r.elapsed = block;
+		periodic.blockStarted(block, r);
+	}
+	REQUIRE(periodic.count() > 1);
+	REQUIRE(periodic.entry(periodic.count() - 1).elapsed >= 100000);
+
+	// an index full of events has nothing to thin, and still takes blocks
+	Bonk::TelemetryIndex<4> events;
+	for (uint8_t i = 0; i < 4; i++) {
+		r.event = (Bonk::FlightEvent)(i + 1);
+		events.logged(r);
+	}
+	for (uint32_t block = 0; block < 200000; block++) {
+		events.blockStarted(block, r);
+	}
+	REQUIRE(events.count() == 4);
+	REQUIRE(events.entry(3).kind == Bonk::TELEMETRY_INDEX_EVENT);
+}
+
+TEST_CASE("Index is written with a footer that finds it") {
+	Bonk::BasicTelemetryLog<16> log(10);
+	FAKE_sdFiles["/idx.bin"] = "junk from before";
+	REQUIRE(log.begin("/idx.bin"));
+	for (int i = 0; i < 55; i++) {
+		log.log(reading(i, 20));
+	}
+	log.close();
+
+	const std::string& file = FAKE_sdFiles["/idx.bin"];
+	REQUIRE(file.compare(file.size() - 4, 4, "BEND") == 0);
+	uint32_t offset = le32(file, file.size() - Bonk::TELEMETRY_FOOTER_SIZE);
+	REQUIRE(file.compare(offset, 4, "BIDX") == 0);
+	uint8_t count = file[offset + 4];
+	REQUIRE(count == log.index().count());
+	size_t crcAt = offset + 6 + count * Bonk::TELEMETRY_INDEX_ENTRY_SIZE;
+	REQUIRE(crcAt + 2 + Bonk::TELEMETRY_FOOTER_SIZE == file.size());
+	uint16_t crc = 0xFFFF;
+	for (size_t i = offset; i < crcAt; i++) {
+		crc = Bonk::crc16Update(crc, file[i]);
+	}
+	REQUIRE(((uint8_t)file[crcAt] | (uint8_t)file[crcAt + 1] << 8) == crc);
+
+	// every entry points at a block whose readings get to the entry's time
+	for (uint8_t i = 0; i < count; i++) {
+		Bonk::TelemetryIndexEntry entry = Bonk::decodeIndexEntry(
+			(const uint8_t *)file.data() + offset + 6 + i * Bonk::TELEMETRY_INDEX_ENTRY_SIZE);
+		REQUIRE((uint8_t)file[entry.offset] == Bonk::TELEMETRY_MAGIC[0]);
+		REQUIRE((uint8_t)file[entry.offset + 1] == Bonk::TELEMETRY_MAGIC[1]);
+		Bonk::TelemetryDecoder decoder;
+		bool found = false;
+		for (size_t j = entry.offset; j < offset && !found; j++) {
+			if (decoder.push(file[j]) == Bonk::TelemetryDecoder::Result::READING) {
+				REQUIRE((uint32_t)decoder.reading().elapsed <= entry.elapsed);
+				found = (uint32_t)decoder.reading().elapsed == entry.elapsed;
+			}
+		}
+		REQUIRE(found);
+		if (entry.kind == Bonk::TELEMETRY_INDEX_EVENT) {
+			REQUIRE(Bonk::flightEventChar(decoder.reading().event) == entry.event);
+		}
+	}
+}
+
+TEST_CASE("Finds the entry to start decoding from") {
+	const Bonk::TelemetryIndexEntry entries[] = {
+		{ 0, 0, '@', Bonk::TELEMETRY_INDEX_PERIODIC },
+		{ 1000, 50, '@', Bonk::TELEMETRY_INDEX_PERIODIC },
+		{ 1500, 50, 'A', Bonk::TELEMETRY_INDEX_EVENT },
+		{ 2000, 90, 'A', Bonk::TELEMETRY_INDEX_PERIODIC },
+	};
+	REQUIRE(Bonk::findIndexEntry(entries, 4, 0) == 0);
+	REQUIRE(Bonk::findIndexEntry(entries, 4, 999) == 0);
+	REQUIRE(Bonk::findIndexEntry(entries, 4, 1700) == 2);
+	REQUIRE(Bonk::findIndexEntry(entries, 4, 5000) == 3);
+	REQUIRE(Bonk::findIndexEntry(entries + 1, 3, 500) == -1);
+}
@@ -0,0 +1,103 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+#include "catch.hpp"
+
+#include "otherMocks.h"
+#include "Serial.h"
+
+#include <EventHandler.h>
+
+const Bonk::TriggerRule rules[] = {
+	// above 100km, reset below 90km
+	{ Bonk::ReadingField::Altitude, Bonk::TriggerComparison::ABOVE, 100000000, 10000000, 0 },
+	// aTotal < 0.1g for 2s
+	{ Bonk::ReadingField::ATotal, Bonk::TriggerComparison::BELOW, 980665, 100000, 2000 },
+	// launchImminent rising edge
+	{ Bonk::ReadingField::LaunchImminent, Bonk::TriggerComparison::ABOVE, 0, 0, 0 },
+};
+
+Bonk::ShipReading reading(int32_t elapsed, int32_t altitude, int32_t aTotal, bool launchImminent) {
+	Bonk::ShipReading r = { 0 };
+	r.elapsed = elapsed;
+	r.altitude = altitude;
+	r.aTotal = aTotal;
+	r.launchImminent = launchImminent;
+	return r;
+}
+
+TEST_CASE("Reads fields by name") {
+	Bonk::ShipReading r = reading(1, 2, 3, true);
+	r.angz = 4;
+	r.chuteFaultWarning = true;
+	REQUIRE(Bonk::readingField(r, Bonk::ReadingField::Elapsed) == 1);
+	REQUIRE(Bonk::readingField(r, Bonk::ReadingField::Altitude) == 2);
+	REQUIRE(Bonk::readingField(r, Bonk::ReadingField::ATotal) == 3);
+	REQUIRE(Bonk::readingField(r, Bonk::ReadingField::AngZ) == 4);
+	REQUIRE(Bonk::readingField(r, Bonk::ReadingField::LaunchImminent) == 1);
+	REQUIRE(Bonk::readingField(r, Bonk::ReadingField::LandingImminent) == 0);
+	REQUIRE(Bonk::readingField(r, Bonk::ReadingField::ChuteFaultWarning) == 1);
+}
+
+TEST_CASE("Fires once past the threshold, again only after hysteresis") {
+	Bonk::Triggers<3> triggers(rules);
+	const long g = 9806650;
+	REQUIRE(triggers.evaluate(reading(0, 0, g, false)) == 0);
+	REQUIRE(triggers.evaluate(reading(100, 100000001, g, false)) == 1);
+	REQUIRE(triggers.active(0));
+	REQUIRE(triggers.evaluate(reading(200, 200000000, g, false)) == 0);
+	// not far enough back down to reset
+	REQUIRE(triggers.evaluate(reading(300, 95000000, g, false)) == 0);
+	REQUIRE(triggers.evaluate(reading(400, 100000001, g, false)) == 0);
+	REQUIRE(triggers.evaluate(reading(500, 89000000, g, false)) == 0);
+	REQUIRE(!triggers.active(0));
+	REQUIRE(triggers.evaluate(reading(600, 100000001, g, false)) == 1);
+}
+
+TEST_CASE("Waits out the hold time") {
+	Bonk::Triggers<3> triggers(rules);
+	REQUIRE(triggers.evaluate(reading(0, 0, 500000, false)) == 0);
+	REQUIRE(triggers.evaluate(reading(1900, 0, 500000, false)) == 0);
+	// a blip resets it
+	REQUIRE(triggers.evaluate(reading(2000, 0, 1000000, false)) == 0);
+	REQUIRE(triggers.evaluate(reading(2100, 0, 500000, false)) == 0);
+	REQUIRE(triggers.evaluate(reading(4000, 0, 400000, false)) == 0);
+	// same value, but the hold time is up
+	REQUIRE(triggers.evaluate(reading(4100, 0, 400000, false)) == 2);
+	REQUIRE(triggers.active(1));
+}
+
+TEST_CASE("Bools fire on the rising edge") {
+	Bonk::Triggers<3> triggers(rules);
+	const long g = 9806650;
+	REQUIRE(triggers.evaluate(reading(0, 0, g, false)) == 0);
+	REQUIRE(triggers.evaluate(reading(100, 0, g, true)) == 4);
+	REQUIRE(triggers.evaluate(reading(200, 0, g, true)) == 0);
+	REQUIRE(triggers.evaluate(reading(300, 0, g, false)) == 0);
+	REQUIRE(triggers.evaluate(reading(400, 0, g, true)) == 4);
+}
+
+class TriggeredEventHandler: public Bonk::EventHandler {
+public:
+	mutable std::string log;
+protected:
+	void onLiftoff() const override {
+		log += 'L';
+	}
+	void onTrigger(uint8_t rule) const override {
+		log += '0' + rule;
+	}
+};
+
+TEST_CASE("EventHandler dispatches triggers after the flight event") {
+	FAKE_millis = 0;
+	Bonk::Triggers<3> triggers(rules);
+	TriggeredEventHandler teh;
+	teh.setTriggers(triggers);
+	teh.begin();
+	Serial.FAKE_replaceBuffer("C,1,200000.000,1,1,1,1,1,1,1,1,1,1,1,1,1,1,1,0,0,0");
+	teh.tick();
+	FAKE_millis = 10;
+	teh.tick();
+	REQUIRE(teh.log == "L02");
+}
@@ -0,0 +1,162 @@
+// Copyright (c) 2020 Mark Polyakov, released under GPLv3
+// Wire (I2C) library mock: a simulated bus that devices can be attached to,
+// which counts every transaction and byte that goes over it.
+
+#ifndef WIRE_H
+#define WIRE_H
+
+#include <inttypes.h>
+#include <stddef.h>
+
+// from otherMocks.h
+void FAKE_advanceMicros(unsigned long us);
+
+// A register-level model of something on the bus. See I2cDevices.h.
+class FakeI2cDevice {
+public:
+	virtual ~FakeI2cDevice() { }
+	// a write transaction addressed to this device, complete with all its
+	// data bytes (the first of which is usually a register pointer).
+	virtual void FAKE_receive(const uint8_t *data, size_t size) = 0;
+	// a read transaction addressed to this device is starting.
+	virtual void FAKE_startRead() { }
+	// the device puts the next byte of a read transaction on the bus.
+	virtual uint8_t FAKE_transmit() = 0;
+};
+
+// Transaction accounting. A transaction is everything between a start and a
+// stop condition: one endTransmission() or one requestFrom().
+struct FakeI2cStats {
+	unsigned long transactions;
+	unsigned long bytes; // including address bytes
+	unsigned long bits;  // including start, stop and acks
+
+	// how long all of that takes on the wire at the given SCL frequency.
+	// Ignores clock stretching and the gaps between transactions, so it's a
+	// lower bound, but it's a good one for comparing two versions of a driver.
+	unsigned long micros(unsigned long clockHz) const {
+		return (unsigned long)((unsigned long long)bits * 1000000 / clockHz);
+	}
+};
+
+class TwoWire {
+public:
+	TwoWire(): FAKE_stallMicros(0), _stats({ 0, 0, 0 }), _timingClockHz(0), _txAddress(0), _txSize(0), _rxSize(0), _rxN(0) {
+		for (int i = 0; i < 128; i++) {
+			_devices[i] = nullptr;
+		}
+	}
+
+	void begin() { }
+	void setClock(unsigned long) { }
+
+	void beginTransmission(int address) {
+		_txAddress = address;
+		_txSize = 0;
+	}
+
+	size_t write(uint8_t data) {
+		if (_txSize == TX_BUFFER_SIZE) {
+			return 0;
+		}
+		_txBuffer[_txSize++] = data;
+		return 1;
+	}
+	size_t write(const uint8_t *data, size_t size) {
+		size_t n = 0;
+		while (n < size && write(data[n])) {
+			n++;
+		}
+		return n;
+	}
+
+	// 0 on success, 2 if nobody acknowledged the address, like the real thing.
+	uint8_t endTransmission(bool sendStop = true) {
+		_account(_txSize);
+		FakeI2cDevice *device = _devices[_txAddress & 0x7F];
+		if (device == nullptr) {
+			return 2;
+		}
+		device->FAKE_receive(_txBuffer, _txSize);
+		return 0;
+	}
+
+	// the real library has a pile of overloads, which are ambiguous for
+	// (uint8_t, int). One is enough here.
+	uint8_t requestFrom(int address, int quantity) {
+		_account(quantity);
+		_rxSize = 0;
+		_rxN = 0;
+		FakeI2cDevice *device = _devices[address & 0x7F];
+		if (device == nullptr) {
+			return 0;
+		}
+		device->FAKE_startRead();
+		while (_rxSize < (size_t)quantity && _rxSize < RX_BUFFER_SIZE) {
+			_rxBuffer[_rxSize++] = device->FAKE_transmit();
+		}
+		return _rxSize;
+	}
+
+	int available() const {
+		return _rxSize - _rxN;
+	}
+	int read() {
+		return available() > 0 ? _rxBuffer[_rxN++] : -1;
+	}
+
+	void FAKE_attach(uint8_t address, FakeI2cDevice *device) {
+		_devices[address & 0x7F] = device;
+	}
+	void FAKE_detachAll() {
+		for (int i = 0; i < 128; i++) {
+			_devices[i] = nullptr;
+		}
+	}
+	const FakeI2cStats& FAKE_stats() const {
+		return _stats;
+	}
+	void FAKE_resetStats() {
+		_stats = { 0, 0, 0 };
+	}
+	// make every transaction take as long as it would at clockHz on the fake
+	// clock, so anything timed with millis() or micros() sees the bus cost.
+	// 0 (the default) makes the bus instantaneous again.
+	void FAKE_simulateTiming(unsigned long clockHz) {
+		_timingClockHz = clockHz;
+	}
+	// extra fake time added to every transaction, eg a device stretching the
+	// clock.
+	unsigned long FAKE_stallMicros;
+private:
+	static const size_t TX_BUFFER_SIZE = 32; // same as the AVR core
+	static const size_t RX_BUFFER_SIZE = 32;
+
+	FakeI2cStats _stats;
+	unsigned long _timingClockHz;
+	FakeI2cDevice *_devices[128];
+	uint8_t _txAddress;
+	uint8_t _txBuffer[TX_BUFFER_SIZE];
+	size_t _txSize;
+	uint8_t _rxBuffer[RX_BUFFER_SIZE];
+	size_t _rxSize;
+	size_t _rxN;
+
+	// start + address + data + stop, with an ack bit after every byte.
+	void _account(size_t dataBytes) {
+		unsigned long bits = 1 + 9 * (dataBytes + 1) + 1;
+		_stats.transactions++;
+		_stats.bytes += dataBytes + 1;
+		_stats.bits += bits;
+		if (_timingClockHz != 0) {
+			FAKE_advanceMicros(bits * 1000000 / _timingClockHz);
+		}
+		if (FAKE_stallMicros != 0) {
+			FAKE_advanceMicros(FAKE_stallMicros);
+		}
+	}
+};
+
+TwoWire Wire;
+
+#endif // WIRE_H
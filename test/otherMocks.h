@@ -1,7 +1,84 @@
 typedef std::string String;
+typedef bool boolean;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
 
 int FAKE_millis = 0;
+// the part of the fake clock that's finer than a millisecond
+unsigned long FAKE_subMillisMicros = 0;
+
+// Simulated interrupts. A mock that raises them sets FAKE_interruptSource,
+// which gets called whenever the code under test could have noticed that
+// time has passed (it reads the clock, or turns interrupts back on) and
+// runs the handler for everything that's happened since, with the clock
+// reading FAKE_interruptAt inside the handler, ie when it happened.
+void (*FAKE_interruptSource)() = nullptr;
+bool FAKE_interruptsEnabled = true;
+bool FAKE_inInterrupt = false;
+unsigned long FAKE_interruptAt = 0;
+
+void FAKE_runInterrupts() {
+	if (FAKE_interruptSource != nullptr && FAKE_interruptsEnabled && !FAKE_inInterrupt) {
+		FAKE_inInterrupt = true;
+		FAKE_interruptSource();
+		FAKE_inInterrupt = false;
+	}
+}
+
+void noInterrupts() {
+	FAKE_interruptsEnabled = false;
+}
+
+void interrupts() {
+	FAKE_interruptsEnabled = true;
+	FAKE_runInterrupts();
+}
 
 int millis() {
+	if (FAKE_inInterrupt) {
+		return FAKE_interruptAt / 1000;
+	}
+	FAKE_runInterrupts();
 	return FAKE_millis;
 }
+
+unsigned long micros() {
+	if (FAKE_inInterrupt) {
+		return FAKE_interruptAt;
+	}
+	FAKE_runInterrupts();
+	return FAKE_millis * 1000UL + FAKE_subMillisMicros;
+}
+
+// let fake time pass, eg because a mock peripheral is slow.
+void FAKE_advanceMicros(unsigned long us) {
+	FAKE_subMillisMicros += us;
+	FAKE_millis += FAKE_subMillisMicros / 1000;
+	FAKE_subMillisMicros %= 1000;
+	FAKE_runInterrupts();
+}
+
+void delay(unsigned long ms) {
+	FAKE_millis += ms;
+}
+
+// levels of the Arduino's own pins. Tests set inputs directly, and can check
+// what the code under test wrote to outputs.
+uint8_t FAKE_pinLevels[32];
+uint8_t FAKE_pinModes[32];
+
+void pinMode(uint8_t pin, uint8_t mode) {
+	FAKE_pinModes[pin] = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t level) {
+	FAKE_pinLevels[pin] = level;
+}
+
+int digitalRead(uint8_t pin) {
+	return FAKE_pinLevels[pin];
+}
@@ -0,0 +1,457 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+// Decodes every TelemetryLog block in a recovered file or a whole card image,
+// on all cores:
+//
+//   bonk-decode card.img > flight.csv
+//   bonk-decode card.img --columns=flight.d
+//
+// The file is memory-mapped and cut into chunks. Each chunk is decoded on its
+// own: it takes the blocks whose magic is in the chunk, and finds its first
+// one by trying every magic until a block's CRC checks out, so chunks don't
+// need the index and junk between files on an image is skipped. Output is in
+// file order, the same as decoding the whole thing in one go.
+//
+// --columns=DIR writes one little-endian binary file per field instead, named
+// after the ShipReading member, with elements the size of the field in a
+// binary record (see ShipReading.h), plus event.bin and schema.csv. In numpy,
+// np.fromfile("DIR/altitude.bin", "<i4") / 1e3 is the altitude in meters.
+//
+// Flight event changes, block counts and how much of the file wasn't
+// telemetry go to stderr.
+//
+// Options: --threads=N (default: all cores), --chunk=BYTES (default 16MiB).
+//
+// The other files the framework leaves on the card are small, and decoded on
+// one thread:
+//
+//   bonk-decode state.bin --state-record=BYTES > state.csv
+//   bonk-decode log.txt --log > log.csv
+//
+// --state-record reads StateManager's state file, the history of states it
+// flushed from EEPROM each time the EEPROM filled up: per flush, the write
+// count (2 bytes, little endian) and that many records. BYTES is sizeof() the
+// payload's state struct on the ship, which only the sketch knows. Each record
+// comes out as flush,write,bytes in hex. The EEPROM still holds the writes
+// since the last flush.
+//
+// --log picks the ERR, NOTIFY and WARN lines out of LogManager's log, those
+// replayed from the black box after a reset included, as level,millis,message.
+// DEBUG lines never reach the card.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <ShipReading.h>
+#include <TelemetryCodec.h>
+
+// a block can't be longer than this, because blockRecords is a uint8_t
+const size_t MAX_BLOCK_SIZE = 255 * (size_t)Bonk::TELEMETRY_MAX_ENCODED;
+
+struct EventChange {
+	Bonk::FlightEvent event;
+	long elapsed;
+};
+
+struct Chunk {
+	std::vector<Bonk::ShipReading> readings;
+	std::string csv;
+	std::vector<std::string> columns; // event, then each field
+	// the first reading's event, then every change
+	std::vector<EventChange> events;
+	uint64_t numReadings = 0;
+	uint64_t blockBytes = 0; // bytes in good blocks that start in the chunk
+	uint32_t blocks = 0;
+	bool done = false;
+};
+
+// Decodes the block at data[at], if there is a good one there, appending its
+// readings to out. Returns the block's size, or 0 if it's not a good block.
+size_t decodeBlock(const uint8_t *data, size_t size, size_t at, std::vector<Bonk::ShipReading>& out) {
+	size_t first = out.size();
+	size_t end = at + MAX_BLOCK_SIZE < size ? at + MAX_BLOCK_SIZE : size;
+	Bonk::TelemetryDecoder decoder;
+	for (size_t i = at; i < end; i++) {
+		switch (decoder.push(data[i])) {
+		case Bonk::TelemetryDecoder::Result::READING:
+			out.push_back(decoder.reading());
+			break;
+		case Bonk::TelemetryDecoder::Result::BLOCK_OK:
+			return i + 1 - at;
+		case Bonk::TelemetryDecoder::Result::BLOCK_BAD:
+			out.resize(first);
+			return 0;
+		default:
+			break;
+		}
+	}
+	out.resize(first);
+	return 0;
+}
+
+bool mapFile(const char *path, const uint8_t *&data, size_t& size) {
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		return false;
+	}
+	size = st.st_size;
+	data = nullptr;
+	if (size > 0) {
+		void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped == MAP_FAILED) {
+			return false;
+		}
+		madvise(mapped, size, MADV_SEQUENTIAL);
+		data = (const uint8_t *)mapped;
+	}
+	close(fd);
+	return true;
+}
+
+// Returns 1 if the file ends partway through a flush, which is what a reset
+// during flush_to_sd() leaves.
+int decodeState(const uint8_t *data, size_t size, size_t recordSize) {
+	printf("flush,write,state\n");
+	size_t at = 0;
+	unsigned flush = 0;
+	uint64_t records = 0;
+	while (at < size) {
+		if (size - at < 2) {
+			fprintf(stderr, "flush %u stops in its write count\n", flush);
+			return 1;
+		}
+		unsigned writes = data[at] | data[at + 1] << 8;
+		at += 2;
+		for (unsigned i = 0; i < writes; i++, at += recordSize) {
+			if (size - at < recordSize) {
+				fprintf(stderr, "flush %u stops after %u of %u records\n", flush, i, writes);
+				return 1;
+			}
+			printf("%u,%u,", flush, i);
+			for (size_t j = 0; j < recordSize; j++) {
+				printf("%02x", data[at + j]);
+			}
+			printf("\n");
+			records++;
+		}
+		flush++;
+	}
+	fprintf(stderr, "%llu states in %u flushes\n", (unsigned long long)records, flush);
+	return 0;
+}
+
+// the tags LogManager::print_tag() writes
+const struct { const char *tag; const char *level; } LOG_TAGS[] = {
+	{ "[ERR] ", "ERROR" },
+	{ "[NOTIFY] ", "NOTIFY" },
+	{ "[WARN] ", "WARNING" },
+};
+
+int decodeLog(const uint8_t *data, size_t size) {
+	printf("level,millis,message\n");
+	const char *text = (const char *)data;
+	const char *end = text + size;
+	uint64_t lines = 0, skipped = 0;
+	while (text < end) {
+		const char *eol = (const char *)memchr(text, '\n', end - text);
+		if (eol == nullptr) {
+			eol = end;
+		}
+		std::string line(text, eol);
+		text = eol + 1;
+
+		const char *level = nullptr;
+		size_t tagLength = 0;
+		for (auto& tag : LOG_TAGS) {
+			if (line.compare(0, strlen(tag.tag), tag.tag) == 0) {
+				level = tag.level;
+				tagLength = strlen(tag.tag);
+			}
+		}
+		char *stampEnd = nullptr;
+		unsigned long stamp = level == nullptr ? 0 : strtoul(line.c_str() + tagLength, &stampEnd, 10);
+		if (level == nullptr || stampEnd == line.c_str() + tagLength || strncmp(stampEnd, ": ", 2) != 0) {
+			// the message's own line breaks, or a torn write
+			skipped++;
+			continue;
+		}
+		std::string message;
+		for (const char *c = stampEnd + 2; *c != '\0'; c++) {
+			if (*c == '"') {
+				message += '"';
+			}
+			message += *c;
+		}
+		printf("%s,%lu,\"%s\"\n", level, stamp, message.c_str());
+		lines++;
+	}
+	fprintf(stderr, "%llu log lines; %llu other lines skipped\n", (unsigned long long)lines, (unsigned long long)skipped);
+	return 0;
+}
+
+// each field's values as binary record fields, one after the other
+void toColumns(const std::vector<Bonk::ShipReading>& readings, std::vector<std::string>& columns) {
+	std::vector<uint8_t> column(readings.size() * 4);
+	uint8_t *out = column.data();
+	for (const Bonk::ShipReading& reading : readings) {
+		*out++ = Bonk::flightEventChar(reading.event);
+	}
+	columns.emplace_back((const char *)column.data(), out - column.data());
+#define BONK_READING_FIELD(member, Name, type, decimals) \
+	out = column.data(); \
+	for (const Bonk::ShipReading& reading : readings) { \
+		out = Bonk::encodeField(out, reading.member); \
+	} \
+	columns.emplace_back((const char *)column.data(), out - column.data());
+#include <ShipReadingFields.h>
+#undef BONK_READING_FIELD
+}
+
+void decodeChunk(const uint8_t *data, size_t size, size_t begin, size_t end, bool csv, Chunk& chunk) {
+	size_t at = begin;
+	while (at < end) {
+		const uint8_t *magic = (const uint8_t *)memchr(data + at, Bonk::TELEMETRY_MAGIC[0], end - at);
+		if (magic == nullptr) {
+			break;
+		}
+		at = magic - data;
+		if (at + 1 >= size || data[at + 1] != Bonk::TELEMETRY_MAGIC[1]) {
+			at++;
+			continue;
+		}
+		size_t blockSize = decodeBlock(data, size, at, chunk.readings);
+		if (blockSize == 0) {
+			at++;
+			continue;
+		}
+		chunk.blocks++;
+		chunk.blockBytes += blockSize;
+		at += blockSize;
+	}
+	chunk.numReadings = chunk.readings.size();
+	for (const Bonk::ShipReading& reading : chunk.readings) {
+		if (chunk.events.empty() || chunk.events.back().event != reading.event) {
+			chunk.events.push_back({ reading.event, reading.elapsed });
+		}
+	}
+	if (csv) {
+		char row[256];
+		for (const Bonk::ShipReading& reading : chunk.readings) {
+			int n = Bonk::formatReadingCsv(reading, row, sizeof(row));
+			chunk.csv.append(row, n);
+			chunk.csv += '\n';
+		}
+	} else {
+		toColumns(chunk.readings, chunk.columns);
+	}
+	chunk.readings.clear();
+	chunk.readings.shrink_to_fit();
+}
+
+// one open file per column, for --columns
+class ColumnWriter {
+public:
+	bool open(const char *dir) {
+		if (mkdir(dir, 0777) != 0 && errno != EEXIST) {
+			perror(dir);
+			return false;
+		}
+		std::string schema = "column,bytes,decimals\nevent,1,0\n";
+		_files.push_back(openColumn(dir, "event"));
+#define BONK_READING_FIELD(member, Name, type, decimals) \
+		_files.push_back(openColumn(dir, #member)); \
+		schema += #member "," + std::to_string(Bonk::recordFieldSize((type)0)) + "," #decimals "\n";
+#include <ShipReadingFields.h>
+#undef BONK_READING_FIELD
+		FILE *file = openColumn(dir, "schema", ".csv");
+		if (file == nullptr) {
+			return false;
+		}
+		fputs(schema.c_str(), file);
+		fclose(file);
+		for (FILE *column : _files) {
+			if (column == nullptr) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	void write(const std::vector<std::string>& columns) {
+		for (size_t i = 0; i < columns.size(); i++) {
+			fwrite(columns[i].data(), 1, columns[i].size(), _files[i]);
+		}
+	}
+
+	void close() {
+		for (FILE *file : _files) {
+			fclose(file);
+		}
+	}
+private:
+	std::vector<FILE *> _files;
+
+	static FILE *openColumn(const char *dir, const char *name, const char *ext = ".bin") {
+		std::string path = std::string(dir) + "/" + name + ext;
+		FILE *file = fopen(path.c_str(), "wb");
+		if (file == nullptr) {
+			perror(path.c_str());
+		}
+		return file;
+	}
+};
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s FILE [--columns=DIR] [--threads=N] [--chunk=BYTES]\n"
+		                "       %s FILE --state-record=BYTES\n"
+		                "       %s FILE --log\n", argv[0], argv[0], argv[0]);
+		return 2;
+	}
+	const char *path = argv[1];
+	const char *columnsDir = nullptr;
+	unsigned threads = std::thread::hardware_concurrency();
+	size_t chunkSize = 16 << 20;
+	size_t stateRecord = 0;
+	bool log = false;
+	for (int i = 2; i < argc; i++) {
+		if (strncmp(argv[i], "--state-record=", 15) == 0) {
+			stateRecord = atol(argv[i] + 15);
+			if (stateRecord == 0) {
+				fprintf(stderr, "--state-record must be at least 1\n");
+				return 2;
+			}
+		} else if (strcmp(argv[i], "--log") == 0) {
+			log = true;
+		} else if (strncmp(argv[i], "--columns=", 10) == 0) {
+			columnsDir = argv[i] + 10;
+		} else if (strncmp(argv[i], "--threads=", 10) == 0) {
+			threads = atoi(argv[i] + 10);
+		} else if (strncmp(argv[i], "--chunk=", 8) == 0) {
+			chunkSize = atol(argv[i] + 8);
+		} else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 2;
+		}
+	}
+	if (threads == 0) {
+		threads = 1;
+	}
+	if (chunkSize == 0) {
+		fprintf(stderr, "--chunk must be at least 1\n");
+		return 2;
+	}
+
+	const uint8_t *data;
+	size_t size;
+	if (!mapFile(path, data, size)) {
+		perror(path);
+		return 1;
+	}
+	if (stateRecord != 0) {
+		return decodeState(data, size, stateRecord);
+	}
+	if (log) {
+		return decodeLog(data, size);
+	}
+
+	ColumnWriter columns;
+	if (columnsDir != nullptr) {
+		if (!columns.open(columnsDir)) {
+			return 1;
+		}
+	} else {
+		printf("%s\n", Bonk::READING_CSV_HEADER);
+	}
+
+	auto startTime = std::chrono::steady_clock::now();
+	size_t numChunks = (size + chunkSize - 1) / chunkSize;
+	std::vector<Chunk> chunks(numChunks);
+	std::mutex mutex;
+	std::condition_variable changed;
+	size_t nextChunk = 0, written = 0;
+	// workers don't get further ahead of the writer than this, so memory
+	// stays bounded on big images
+	size_t window = 2 * threads;
+
+	auto work = [&]() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			changed.wait(lock, [&]() { return nextChunk >= numChunks || nextChunk < written + window; });
+			if (nextChunk >= numChunks) {
+				return;
+			}
+			size_t i = nextChunk++;
+			lock.unlock();
+			size_t begin = i * chunkSize;
+			size_t end = begin + chunkSize < size ? begin + chunkSize : size;
+			decodeChunk(data, size, begin, end, columnsDir == nullptr, chunks[i]);
+			lock.lock();
+			chunks[i].done = true;
+			changed.notify_all();
+		}
+	};
+	std::vector<std::thread> workers;
+	for (unsigned i = 0; i < threads; i++) {
+		workers.emplace_back(work);
+	}
+
+	uint64_t readings = 0, blockBytes = 0, blocks = 0;
+	bool haveEvent = false;
+	Bonk::FlightEvent event = Bonk::FlightEvent::NoneReached;
+	for (size_t i = 0; i < numChunks; i++) {
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			changed.wait(lock, [&]() { return chunks[i].done; });
+		}
+		Chunk& chunk = chunks[i];
+		if (columnsDir != nullptr) {
+			columns.write(chunk.columns);
+		} else {
+			fwrite(chunk.csv.data(), 1, chunk.csv.size(), stdout);
+		}
+		for (const EventChange& change : chunk.events) {
+			if (!haveEvent || change.event != event) {
+				haveEvent = true;
+				event = change.event;
+				fprintf(stderr, "%c at %ld\n", Bonk::flightEventChar(event), change.elapsed);
+			}
+		}
+		readings += chunk.numReadings;
+		blockBytes += chunk.blockBytes;
+		blocks += chunk.blocks;
+		chunk = Chunk();
+		std::lock_guard<std::mutex> lock(mutex);
+		written = i + 1;
+		changed.notify_all();
+	}
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+	if (columnsDir != nullptr) {
+		columns.close();
+	}
+	fflush(stdout);
+
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	fprintf(stderr, "%llu readings in %llu blocks; %llu of %llu bytes weren't telemetry\n",
+	        (unsigned long long)readings, (unsigned long long)blocks,
+	        (unsigned long long)(size - blockBytes), (unsigned long long)size);
+	fprintf(stderr, "%.2fs on %u threads, %.0f MB/s\n", seconds, threads, size / 1e6 / (seconds > 0 ? seconds : 1e-9));
+	return 0;
+}
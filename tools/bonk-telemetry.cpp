@@ -0,0 +1,346 @@
+// Copyright (c) 2020 Mark Polyakov
+// Released under the GPLv3
+
+// Pulls a time window out of a TelemetryLog file from a recovered card, as
+// CSV, without decoding the whole flight:
+//
+//   bonk-telemetry flight.bin                     list the index
+//   bonk-telemetry flight.bin --from=1000 --to=5000
+//   bonk-telemetry flight.bin --event=Apogee --before=2000 --after=5000
+//
+// Times are the ship's elapsed milliseconds. FILE can be the telemetry file
+// or a whole card image: it's memory-mapped, and only the index and the
+// blocks in the window are read. Uses the last intact index in it if there is
+// one, or bisects on block keyframes if the payload never got to close the
+// file. --no-index forces the latter.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <ShipReading.h>
+#include <TelemetryCodec.h>
+#include <TelemetryIndex.h>
+
+// the mapped file
+struct Bytes {
+	const uint8_t *data;
+	size_t length;
+
+	size_t size() const {
+		return length;
+	}
+	const uint8_t& operator[](size_t i) const {
+		return data[i];
+	}
+};
+
+bool mapFile(const char *path, Bytes& out) {
+	int fd = open(path, O_RDONLY);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		return false;
+	}
+	out.length = st.st_size;
+	out.data = nullptr;
+	if (out.length > 0) {
+		void *mapped = mmap(nullptr, out.length, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (mapped == MAP_FAILED) {
+			return false;
+		}
+		madvise(mapped, out.length, MADV_RANDOM);
+		out.data = (const uint8_t *)mapped;
+	}
+	close(fd);
+	return true;
+}
+
+uint32_t le32(const uint8_t *in) {
+	return in[0] | (uint32_t)in[1] << 8 | (uint32_t)in[2] << 16 | (uint32_t)in[3] << 24;
+}
+
+// The index block that ends just before the footer at footerAt, if it's
+// intact, and where its file starts in data. The footer only has the index's
+// offset in its own file, which is how that's found on a card image.
+bool indexBefore(const Bytes& data, size_t footerAt, std::vector<Bonk::TelemetryIndexEntry>& entries, size_t& base) {
+	uint32_t offset = le32(&data[footerAt]);
+	for (size_t count = 0; count <= 255; count++) {
+		size_t size = 6 + count * Bonk::TELEMETRY_INDEX_ENTRY_SIZE + 2;
+		if (size > footerAt) {
+			return false;
+		}
+		size_t at = footerAt - size;
+		if (at < offset || data[at + 4] != count || data[at + 5] != 0 ||
+		    memcmp(&data[at], Bonk::TELEMETRY_INDEX_MAGIC, 4) != 0) {
+			continue;
+		}
+		size_t crcAt = footerAt - 2;
+		uint16_t crc = 0xFFFF;
+		for (size_t i = at; i < crcAt; i++) {
+			crc = Bonk::crc16Update(crc, data[i]);
+		}
+		if (crc != (data[crcAt] | data[crcAt + 1] << 8)) {
+			continue;
+		}
+		base = at - offset;
+		for (size_t i = 0; i < count; i++) {
+			entries.push_back(Bonk::decodeIndexEntry(&data[at + 6 + i * Bonk::TELEMETRY_INDEX_ENTRY_SIZE]));
+		}
+		return true;
+	}
+	return false;
+}
+
+// The last intact index in data, and where its file starts. For a file
+// that's a footer in the last 8 bytes; in a card image, the last footer
+// magic with an intact index behind it.
+bool readIndex(const Bytes& data, std::vector<Bonk::TelemetryIndexEntry>& entries, size_t& base) {
+	size_t end = data.size();
+	while (end >= Bonk::TELEMETRY_FOOTER_SIZE) {
+		// the last byte of a footer at or before end
+		const uint8_t *last = (const uint8_t *)memrchr(data.data + Bonk::TELEMETRY_FOOTER_SIZE - 1,
+		                                               Bonk::TELEMETRY_FOOTER_MAGIC[3],
+		                                               end - (Bonk::TELEMETRY_FOOTER_SIZE - 1));
+		if (last == nullptr) {
+			return false;
+		}
+		end = last + 1 - data.data;
+		if (memcmp(last - 3, Bonk::TELEMETRY_FOOTER_MAGIC, 4) == 0 &&
+		    indexBefore(data, end - Bonk::TELEMETRY_FOOTER_SIZE, entries, base)) {
+			return true;
+		}
+		end--;
+	}
+	return false;
+}
+
+// Decodes the block at data[at], calling found on each of its readings once
+// the block's CRC has checked out, until found returns false. Returns the
+// block's size, or 0 if there isn't a good block there.
+template <typename Found>
+size_t decodeBlock(const Bytes& data, size_t at, Found found, bool& more) {
+	std::vector<Bonk::ShipReading> readings;
+	Bonk::TelemetryDecoder decoder;
+	more = true;
+	for (size_t i = at; i < data.size(); i++) {
+		switch (decoder.push(data[i])) {
+		case Bonk::TelemetryDecoder::Result::READING:
+			readings.push_back(decoder.reading());
+			break;
+		case Bonk::TelemetryDecoder::Result::BLOCK_OK:
+			for (const Bonk::ShipReading& reading : readings) {
+				if (!found(reading)) {
+					more = false;
+					break;
+				}
+			}
+			return i + 1 - at;
+		case Bonk::TelemetryDecoder::Result::BLOCK_BAD:
+			return 0;
+		default:
+			break;
+		}
+	}
+	return 0;
+}
+
+// The first good block that starts at or after from, and its keyframe.
+bool keyframeAt(const Bytes& data, size_t from, size_t& blockOffset, Bonk::ShipReading& keyframe) {
+	for (size_t at = from; at + 1 < data.size(); at++) {
+		if (data[at] != Bonk::TELEMETRY_MAGIC[0] || data[at + 1] != Bonk::TELEMETRY_MAGIC[1]) {
+			continue;
+		}
+		bool more;
+		if (decodeBlock(data, at, [&](const Bonk::ShipReading& r) { keyframe = r; return false; }, more) > 0) {
+			blockOffset = at;
+			return true;
+		}
+	}
+	return false;
+}
+
+// The last block whose keyframe is before(), found in O(log n) probes. 0 if
+// there isn't one.
+template <typename Before>
+size_t bisect(const Bytes& data, Before before) {
+	size_t candidate = 0, lo = 1, hi = data.size();
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		size_t block;
+		Bonk::ShipReading keyframe;
+		if (!keyframeAt(data, mid, block, keyframe) || block >= hi) {
+			hi = mid;
+		} else if (before(keyframe)) {
+			candidate = block;
+			lo = block + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return candidate;
+}
+
+// where to start decoding to get to elapsed. base is where the indexed
+// file starts.
+size_t startFor(const Bytes& data, const std::vector<Bonk::TelemetryIndexEntry>& index, size_t base, uint32_t elapsed) {
+	if (!index.empty()) {
+		int i = Bonk::findIndexEntry(index.data(), index.size(), elapsed);
+		return base + (i < 0 ? 0 : index[i].offset);
+	}
+	return bisect(data, [elapsed](const Bonk::ShipReading& r) { return (uint32_t)r.elapsed <= elapsed; });
+}
+
+// Decodes the good blocks from start on, calling found on every reading
+// until it returns false. Readings in a corrupt block are skipped whole.
+template <typename Found>
+void decodeFrom(const Bytes& data, size_t start, Found found) {
+	size_t at = start;
+	while (at + 1 < data.size()) {
+		const uint8_t *magic = (const uint8_t *)memchr(data.data + at, Bonk::TELEMETRY_MAGIC[0], data.size() - at);
+		if (magic == nullptr) {
+			return;
+		}
+		at = magic - data.data;
+		if (at + 1 >= data.size() || data[at + 1] != Bonk::TELEMETRY_MAGIC[1]) {
+			at++;
+			continue;
+		}
+		bool more;
+		size_t size = decodeBlock(data, at, found, more);
+		if (!more) {
+			return;
+		}
+		if (size == 0) {
+			fprintf(stderr, "warning: corrupt block at offset %zu\n", at);
+			at++;
+			continue;
+		}
+		at += size;
+	}
+}
+
+// elapsed at the first reading of event, or false if it never happened
+bool findEvent(const Bytes& data, const std::vector<Bonk::TelemetryIndexEntry>& index,
+               Bonk::FlightEvent event, uint32_t& elapsed) {
+	char c = Bonk::flightEventChar(event);
+	size_t start = 0;
+	if (!index.empty()) {
+		for (const Bonk::TelemetryIndexEntry& entry : index) {
+			if (entry.kind == Bonk::TELEMETRY_INDEX_EVENT && entry.event == c) {
+				elapsed = entry.elapsed;
+				return true;
+			}
+		}
+		return false;
+	} else {
+		// events only go forwards, so they can be bisected on too
+		start = bisect(data, [event](const Bonk::ShipReading& r) { return r.event < event; });
+	}
+	bool found = false;
+	decodeFrom(data, start, [&](const Bonk::ShipReading& r) {
+		if (r.event == event) {
+			elapsed = r.elapsed;
+			found = true;
+		}
+		return !found;
+	});
+	return found;
+}
+
+bool eventNamed(const char *name, Bonk::FlightEvent& event) {
+#define BONK_FLIGHT_EVENT(eventChar, flightEvent) \
+	if (strcmp(name, #flightEvent) == 0) { event = Bonk::FlightEvent::flightEvent; return true; }
+#include <FlightEvents.h>
+#undef BONK_FLIGHT_EVENT
+	return false;
+}
+
+int main(int argc, char **argv) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s FILE [--from=MS] [--to=MS] [--event=NAME [--before=MS] [--after=MS]] [--no-index]\n", argv[0]);
+		return 2;
+	}
+	const char *path = argv[1];
+	long from = -1, to = -1, before = 0, after = 0;
+	const char *eventName = nullptr;
+	bool useIndex = true;
+	for (int i = 2; i < argc; i++) {
+		if (strncmp(argv[i], "--from=", 7) == 0) {
+			from = atol(argv[i] + 7);
+		} else if (strncmp(argv[i], "--to=", 5) == 0) {
+			to = atol(argv[i] + 5);
+		} else if (strncmp(argv[i], "--event=", 8) == 0) {
+			eventName = argv[i] + 8;
+		} else if (strncmp(argv[i], "--before=", 9) == 0) {
+			before = atol(argv[i] + 9);
+		} else if (strncmp(argv[i], "--after=", 8) == 0) {
+			after = atol(argv[i] + 8);
+		} else if (strcmp(argv[i], "--no-index") == 0) {
+			useIndex = false;
+		} else {
+			fprintf(stderr, "unknown option %s\n", argv[i]);
+			return 2;
+		}
+	}
+
+	Bytes data;
+	if (!mapFile(path, data)) {
+		perror(path);
+		return 1;
+	}
+	std::vector<Bonk::TelemetryIndexEntry> index;
+	size_t base = 0;
+	bool indexed = useIndex && readIndex(data, index, base);
+
+	if (eventName != nullptr) {
+		Bonk::FlightEvent event;
+		if (!eventNamed(eventName, event)) {
+			fprintf(stderr, "no such event %s\n", eventName);
+			return 2;
+		}
+		uint32_t elapsed;
+		if (!findEvent(data, index, event, elapsed)) {
+			fprintf(stderr, "%s never happened\n", eventName);
+			return 1;
+		}
+		from = (long)elapsed > before ? elapsed - before : 0;
+		to = elapsed + after;
+	}
+
+	if (from < 0 && to < 0) {
+		if (!indexed) {
+			printf("no index\n");
+			return 0;
+		}
+		printf("elapsed,offset,event,kind\n");
+		for (const Bonk::TelemetryIndexEntry& entry : index) {
+			printf("%lu,%lu,%c,%s\n", (unsigned long)entry.elapsed, (unsigned long)entry.offset, entry.event,
+			       entry.kind == Bonk::TELEMETRY_INDEX_EVENT ? "event" : "periodic");
+		}
+		return 0;
+	}
+	if (from < 0) {
+		from = 0;
+	}
+
+	printf("%s\n", Bonk::READING_CSV_HEADER);
+	decodeFrom(data, startFor(data, index, base, from), [&](const Bonk::ShipReading& r) {
+		if (to >= 0 && r.elapsed > to) {
+			return false;
+		}
+		if (r.elapsed >= from) {
+			char row[256];
+			Bonk::formatReadingCsv(r, row, sizeof(row));
+			printf("%s\n", row);
+		}
+		return true;
+	});
+	return 0;
+}